@@ -0,0 +1,365 @@
+/*  bgzf.c
+ *  Reading and writing of BGZF (blocked gzip) files for ssw_test, with the blocks inflated or deflated by helper threads.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <zlib.h>
+#include <pthread.h>
+#include "bgzf.h"
+
+#define BGZF_MAX 65536	// largest block, compressed or not
+
+typedef struct {
+	uint8_t* raw;	// the block as read: deflate data, CRC32 and ISIZE
+	uint8_t* data;	// the block inflated
+	int32_t raw_l, l, pos;	// l < 0: the block could not be inflated; pos: next byte of data to give to the reader
+	int8_t state;	// 0: free; 1: being inflated; 2: inflated
+} bgzf_block;
+
+struct _bgzf_file {
+	gzFile gz;	// not a BGZF file: read with gzread
+	FILE* fp;
+	pthread_t* tid;
+	int32_t n_thread;
+	bgzf_block* block;	// block k is held in block[k % n_block]
+	int32_t n_block;
+	int64_t n_read, next;	// blocks read from the file and next block to give to the reader
+	int8_t eof, error, stop;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+};
+
+/* Read the next block of the file: 1 if read, 0 at the end of the file, -1 if it is not a valid block. */
+static int32_t read_block (FILE* fp, bgzf_block* b) {
+	uint8_t h[12], x[BGZF_MAX];
+	int32_t xlen, i, size = -1;
+	size_t n = fread(h, 1, 12, fp);
+	if (n == 0) return 0;
+	if (n < 12 || h[0] != 31 || h[1] != 139 || h[2] != 8 || (h[3] & 4) == 0) return -1;
+	xlen = h[10] | h[11] << 8;
+	if (fread(x, 1, xlen, fp) != (size_t)xlen) return -1;
+	for (i = 0; i + 4 <= xlen; i += 4 + (x[i + 2] | x[i + 3] << 8))	// find the BC subfield, which holds the block size - 1
+		if (x[i] == 'B' && x[i + 1] == 'C' && (x[i + 2] | x[i + 3] << 8) == 2 && i + 6 <= xlen) size = (x[i + 4] | x[i + 5] << 8) + 1;
+	b->raw_l = size - 12 - xlen;
+	if (size < 0 || b->raw_l < 8) return -1;
+	return fread(b->raw, 1, b->raw_l, fp) == (size_t)b->raw_l ? 1 : -1;
+}
+
+static int32_t inflate_block (z_stream* zs, bgzf_block* b) {
+	const uint8_t* t = b->raw + b->raw_l - 8;
+	uint32_t crc = t[0] | t[1] << 8 | t[2] << 16 | (uint32_t)t[3] << 24;
+	uint32_t isize = t[4] | t[5] << 8 | t[6] << 16 | (uint32_t)t[7] << 24;
+	b->l = -1;
+	if (isize > BGZF_MAX || inflateReset(zs) != Z_OK) return 0;
+	zs->next_in = b->raw;
+	zs->avail_in = b->raw_l - 8;
+	zs->next_out = b->data;
+	zs->avail_out = BGZF_MAX;
+	if (inflate(zs, Z_FINISH) != Z_STREAM_END || zs->total_out != isize) return 0;
+	if (crc32(crc32(0, 0, 0), b->data, isize) != crc) return 0;
+	b->l = isize;
+	b->pos = 0;
+	return 1;
+}
+
+static void* inflate_blocks (void* data) {
+	bgzf_file* f = (bgzf_file*)data;
+	z_stream zs;
+	memset(&zs, 0, sizeof(z_stream));
+	inflateInit2(&zs, -15);
+	pthread_mutex_lock(&f->lock);
+	for (;;) {
+		bgzf_block* b = &f->block[f->n_read % f->n_block];
+		int32_t r;
+		while (! f->stop && ! f->eof && ! f->error && b->state != 0) {
+			pthread_cond_wait(&f->cond, &f->lock);
+			b = &f->block[f->n_read % f->n_block];
+		}
+		if (f->stop || f->eof || f->error) break;
+		r = read_block(f->fp, b);	// the blocks are read in turn, under the lock
+		if (r <= 0) {
+			if (r == 0) f->eof = 1;
+			else f->error = 1;
+			pthread_cond_broadcast(&f->cond);
+			break;
+		}
+		b->state = 1;
+		++ f->n_read;
+		pthread_mutex_unlock(&f->lock);
+
+		r = inflate_block(&zs, b);	// and inflated in parallel
+
+		pthread_mutex_lock(&f->lock);
+		if (! r) f->error = 1;
+		b->state = 2;
+		pthread_cond_broadcast(&f->cond);
+	}
+	pthread_mutex_unlock(&f->lock);
+	inflateEnd(&zs);
+	return 0;
+}
+
+bgzf_file* bgzf_open (const char* path, int32_t threads) {
+	static const uint8_t magic[16] = {31, 139, 8, 4, 0, 0, 0, 0, 0, 0, 0, 0, 'B', 'C', 2, 0};	// bytes 4 to 11 are not checked
+	bgzf_file* f = (bgzf_file*)calloc(1, sizeof(bgzf_file));
+	uint8_t h[16];
+	int32_t i;
+	f->fp = fopen(path, "rb");
+	if (f->fp && (fread(h, 1, 16, f->fp) != 16 || memcmp(h, magic, 4) || memcmp(h + 12, magic + 12, 4))) {
+		fclose(f->fp);
+		f->fp = 0;
+		f->gz = gzopen(path, "r");
+		if (f->gz) return f;
+	}
+	if (! f->fp) {
+		free(f);
+		return 0;
+	}
+
+	rewind(f->fp);
+	f->n_thread = threads > 0 ? threads : 1;
+	f->n_block = 4 * f->n_thread;
+	f->block = (bgzf_block*)calloc(f->n_block, sizeof(bgzf_block));
+	for (i = 0; i < f->n_block; ++i) {
+		f->block[i].raw = (uint8_t*)malloc(BGZF_MAX);
+		f->block[i].data = (uint8_t*)malloc(BGZF_MAX);
+	}
+	pthread_mutex_init(&f->lock, 0);
+	pthread_cond_init(&f->cond, 0);
+	f->tid = (pthread_t*)calloc(f->n_thread, sizeof(pthread_t));
+	for (i = 0; i < f->n_thread; ++i) pthread_create(&f->tid[i], 0, inflate_blocks, f);
+	return f;
+}
+
+int bgzf_read (bgzf_file* f, void* buf, unsigned len) {
+	unsigned n = 0;
+	if (f->gz) return gzread(f->gz, buf, len);
+	while (n < len) {
+		bgzf_block* b = &f->block[f->next % f->n_block];
+		int32_t l, ready;
+		pthread_mutex_lock(&f->lock);
+		while (b->state != 2 && ! f->error && ! (f->eof && f->next >= f->n_read)) pthread_cond_wait(&f->cond, &f->lock);
+		ready = b->state == 2 && b->l >= 0;
+		pthread_mutex_unlock(&f->lock);
+		if (! ready) break;	// the end of the file, or an error
+
+		l = b->l - b->pos < (int32_t)(len - n) ? b->l - b->pos : (int32_t)(len - n);
+		memcpy((char*)buf + n, b->data + b->pos, l);
+		b->pos += l;
+		n += l;
+		if (b->pos == b->l) {
+			pthread_mutex_lock(&f->lock);
+			b->state = 0;
+			++ f->next;
+			pthread_cond_broadcast(&f->cond);
+			pthread_mutex_unlock(&f->lock);
+		}
+	}
+	return n;
+}
+
+int32_t bgzf_error (bgzf_file* f) {
+	int32_t e;
+	if (f->gz) return 0;
+	pthread_mutex_lock(&f->lock);
+	e = f->error;
+	pthread_mutex_unlock(&f->lock);
+	return e;
+}
+
+void bgzf_close (bgzf_file* f) {
+	int32_t i;
+	if (f->gz) gzclose(f->gz);
+	else {
+		pthread_mutex_lock(&f->lock);
+		f->stop = 1;
+		pthread_cond_broadcast(&f->cond);
+		pthread_mutex_unlock(&f->lock);
+		for (i = 0; i < f->n_thread; ++i) pthread_join(f->tid[i], 0);
+		for (i = 0; i < f->n_block; ++i) {
+			free(f->block[i].raw);
+			free(f->block[i].data);
+		}
+		free(f->block);
+		free(f->tid);
+		pthread_cond_destroy(&f->cond);
+		pthread_mutex_destroy(&f->lock);
+		fclose(f->fp);
+	}
+	free(f);
+}
+
+/* Writing: the caller fills the blocks in turn, the helper threads deflate them in parallel, and the caller writes 
+   them out in order when it comes back to their slot, or when the file is closed. */
+#define BGZF_DATA 65280	// largest input of a block, so that even stored blocks fit in BGZF_MAX
+
+typedef struct {
+	uint8_t* data;	// the bytes to deflate
+	uint8_t* raw;	// the whole block, header included
+	int32_t l, raw_l;
+	int8_t state;	// 0: free; 1: filled; 2: being deflated; 3: deflated
+} bgzf_wblock;
+
+struct _bgzf_writer {
+	int fd;
+	pthread_t* tid;
+	int32_t n_thread;
+	bgzf_wblock* block;	// block k is held in block[k % n_block]
+	int32_t n_block;
+	int64_t n_filled, n_taken, n_written;	// blocks filled by the caller, taken by the helpers and written out
+	int8_t error, stop;	// error: a block could not be deflated
+	int8_t failed;	// a block could not be deflated or written; only seen by the caller
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+};
+
+static void put32 (uint8_t* p, uint32_t x) {
+	p[0] = x;
+	p[1] = x >> 8;
+	p[2] = x >> 16;
+	p[3] = x >> 24;
+}
+
+static int32_t deflate_block (z_stream* zs, bgzf_wblock* b) {
+	static const uint8_t header[18] = {31, 139, 8, 4, 0, 0, 0, 0, 0, 255, 6, 0, 'B', 'C', 2, 0, 0, 0};
+	uint32_t crc = crc32(crc32(0, 0, 0), b->data, b->l);
+	int32_t level, size;
+	for (level = Z_DEFAULT_COMPRESSION; ; level = 0) {	// a block that does not compress is stored
+		if (deflateReset(zs) != Z_OK || deflateParams(zs, level, Z_DEFAULT_STRATEGY) != Z_OK) return 0;
+		zs->next_in = b->data;
+		zs->avail_in = b->l;
+		zs->next_out = b->raw + 18;
+		zs->avail_out = BGZF_MAX - 18 - 8;
+		if (deflate(zs, Z_FINISH) == Z_STREAM_END) break;
+		if (level == 0) return 0;
+	}
+	size = 18 + zs->total_out + 8;
+	memcpy(b->raw, header, 18);
+	b->raw[16] = (size - 1) & 0xff;
+	b->raw[17] = (size - 1) >> 8;
+	put32(b->raw + size - 8, crc);
+	put32(b->raw + size - 4, b->l);
+	b->raw_l = size;
+	return 1;
+}
+
+static void* deflate_blocks (void* data) {
+	bgzf_writer* w = (bgzf_writer*)data;
+	z_stream zs;
+	memset(&zs, 0, sizeof(z_stream));
+	deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY);
+	pthread_mutex_lock(&w->lock);
+	for (;;) {
+		bgzf_wblock* b;
+		int32_t r;
+		while (! w->stop && w->n_taken == w->n_filled) pthread_cond_wait(&w->cond, &w->lock);
+		if (w->n_taken == w->n_filled) break;	// stopped, and all the blocks are taken
+		b = &w->block[w->n_taken++ % w->n_block];
+		b->state = 2;
+		pthread_mutex_unlock(&w->lock);
+
+		r = deflate_block(&zs, b);
+
+		pthread_mutex_lock(&w->lock);
+		if (! r) w->error = 1;
+		b->state = 3;
+		pthread_cond_broadcast(&w->cond);
+	}
+	pthread_mutex_unlock(&w->lock);
+	deflateEnd(&zs);
+	return 0;
+}
+
+static int32_t write_fd (int fd, const uint8_t* s, size_t l) {
+	while (l > 0) {
+		ssize_t k = write(fd, s, l);
+		if (k < 0 && errno == EINTR) continue;
+		if (k <= 0) return -1;
+		s += k;
+		l -= k;
+	}
+	return 0;
+}
+
+/* Write out the oldest block that is not written yet, once it is deflated, and free its slot. */
+static void write_oldest (bgzf_writer* w) {
+	bgzf_wblock* b = &w->block[w->n_written % w->n_block];
+	pthread_mutex_lock(&w->lock);
+	while (b->state != 3) pthread_cond_wait(&w->cond, &w->lock);
+	if (w->error) w->failed = 1;
+	pthread_mutex_unlock(&w->lock);
+	if (! w->failed && write_fd(w->fd, b->raw, b->raw_l)) w->failed = 1;
+	b->state = 0;
+	b->l = 0;
+	++ w->n_written;
+}
+
+/* Hand the block being filled to the helpers. */
+static void submit (bgzf_writer* w) {
+	pthread_mutex_lock(&w->lock);
+	w->block[w->n_filled % w->n_block].state = 1;
+	++ w->n_filled;
+	pthread_cond_broadcast(&w->cond);
+	pthread_mutex_unlock(&w->lock);
+	if (w->n_filled - w->n_written == w->n_block) write_oldest(w);	// the next slot to fill
+}
+
+bgzf_writer* bgzf_wopen (int fd, int32_t threads) {
+	bgzf_writer* w = (bgzf_writer*)calloc(1, sizeof(bgzf_writer));
+	int32_t i;
+	w->fd = fd;
+	w->n_thread = threads > 0 ? threads : 1;
+	w->n_block = 4 * w->n_thread;
+	w->block = (bgzf_wblock*)calloc(w->n_block, sizeof(bgzf_wblock));
+	for (i = 0; i < w->n_block; ++i) {
+		w->block[i].data = (uint8_t*)malloc(BGZF_DATA);
+		w->block[i].raw = (uint8_t*)malloc(BGZF_MAX);
+	}
+	pthread_mutex_init(&w->lock, 0);
+	pthread_cond_init(&w->cond, 0);
+	w->tid = (pthread_t*)calloc(w->n_thread, sizeof(pthread_t));
+	for (i = 0; i < w->n_thread; ++i) pthread_create(&w->tid[i], 0, deflate_blocks, w);
+	return w;
+}
+
+int32_t bgzf_write (bgzf_writer* w, const void* buf, size_t len) {
+	const uint8_t* s = (const uint8_t*)buf;
+	while (len > 0) {
+		bgzf_wblock* b = &w->block[w->n_filled % w->n_block];
+		size_t l = BGZF_DATA - b->l < len ? BGZF_DATA - b->l : len;
+		memcpy(b->data + b->l, s, l);
+		b->l += l;
+		s += l;
+		len -= l;
+		if (b->l == BGZF_DATA) submit(w);
+	}
+	return w->failed ? -1 : 0;
+}
+
+int32_t bgzf_wclose (bgzf_writer* w) {
+	int32_t i, e;
+	if (w->block[w->n_filled % w->n_block].l > 0) submit(w);
+	submit(w);	// an empty block marks the end of the file
+	while (w->n_written < w->n_filled) write_oldest(w);
+	pthread_mutex_lock(&w->lock);
+	w->stop = 1;
+	pthread_cond_broadcast(&w->cond);
+	pthread_mutex_unlock(&w->lock);
+	for (i = 0; i < w->n_thread; ++i) pthread_join(w->tid[i], 0);
+	e = w->failed ? -1 : 0;
+	for (i = 0; i < w->n_block; ++i) {
+		free(w->block[i].data);
+		free(w->block[i].raw);
+	}
+	free(w->block);
+	free(w->tid);
+	pthread_cond_destroy(&w->cond);
+	pthread_mutex_destroy(&w->lock);
+	free(w);
+	return e;
+}
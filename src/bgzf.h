@@ -0,0 +1,72 @@
+/*  bgzf.h
+ *  Reading and writing of BGZF (blocked gzip) files for ssw_test, with the blocks inflated or deflated by helper threads.
+ */
+
+#ifndef BGZF_H
+#define BGZF_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*!	@typedef	structure of a file opened for reading by bgzf_open	*/
+struct _bgzf_file;
+typedef struct _bgzf_file bgzf_file;
+
+/*!	@function	Open a file for reading.
+	@param	path	name of the file
+	@param	threads	number of threads that inflate the blocks of a BGZF file
+	@return	pointer to the file structure; 0 if the file cannot be opened
+	@discussion	BGZF files (e.g. written by bgzip) are cut into independent deflate blocks of at most 64 kB. The helper 
+				threads read the blocks in turn and inflate them in parallel, ahead of the reader, which gets the bytes 
+				back in order. The other files, plain gzip or uncompressed, are read with gzread.
+*/
+bgzf_file* bgzf_open (const char* path, int32_t threads);
+
+/*!	@function	Read the next bytes of a file, as gzread does.
+	@param	f	pointer to the file structure
+	@param	buf	buffer for the bytes
+	@param	len	number of bytes to read
+	@return	number of bytes read; less than len only at the end of the file or after an error
+*/
+int bgzf_read (bgzf_file* f, void* buf, unsigned len);
+
+/*!	@function	Tell whether the file could not be read to its end (a truncated or corrupted BGZF block).
+	@param	f	pointer to the file structure
+	@return	1 after an error, 0 otherwise
+*/
+int32_t bgzf_error (bgzf_file* f);
+
+/*!	@function	Stop the helper threads, close the file and release the memory allocated by function bgzf_open.
+	@param	f	pointer to the file structure
+*/
+void bgzf_close (bgzf_file* f);
+
+/*!	@typedef	structure of a file opened for writing by bgzf_wopen	*/
+struct _bgzf_writer;
+typedef struct _bgzf_writer bgzf_writer;
+
+/*!	@function	Start to write a BGZF file.
+	@param	fd	file descriptor to write to
+	@param	threads	number of threads that deflate the blocks
+	@return	pointer to the writer structure
+	@discussion	The bytes are cut into blocks of 65280 bytes, which the helper threads deflate in parallel while the 
+				next ones are filled; the blocks are written out in order with write.
+*/
+bgzf_writer* bgzf_wopen (int fd, int32_t threads);
+
+/*!	@function	Write bytes to a BGZF file.
+	@param	w	pointer to the writer structure
+	@param	buf	the bytes
+	@param	len	number of bytes
+	@return	0; -1 if a block could not be deflated or written
+*/
+int32_t bgzf_write (bgzf_writer* w, const void* buf, size_t len);
+
+/*!	@function	Write the last block and the end of file marker, stop the helper threads and release the memory 
+				allocated by function bgzf_wopen. The file descriptor is not closed.
+	@param	w	pointer to the writer structure
+	@return	0; -1 if a block could not be deflated or written
+*/
+int32_t bgzf_wclose (bgzf_writer* w);
+
+#endif	// BGZF_H
@@ -145,6 +145,15 @@ int main (int argc, char * const argv[]) {
 	// Only the 8 bit of the flag is setted. ssw_align will always return the best alignment beginning position and cigar.
 	result = ssw_align (profile, ref_num, 39, gap_open, gap_extension, 1, 0, 0, 15);	
 	ssw_write(result, ref_seq, read_seq, nt_table);
+	align_destroy(result);
+	init_destroy(profile);
+
+	// The same alignment with 16-bit scores only (score_size 1), as for reads whose scores may exceed 255.
+	profile = ssw_init(num, 15, mat, 5, 1);
+	result = ssw_align (profile, ref_num, 39, gap_open, gap_extension, 1, 0, 0, 15);	
+	ssw_write(result, ref_seq, read_seq, nt_table);
+	align_destroy(result);
+	init_destroy(profile);
 
 	free(mat);
 	free(ref_num);
@@ -7,14 +7,18 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <emmintrin.h>
-#include <zlib.h>
 #include <stdio.h>
 #include <time.h>
 #include <string.h>
+#include <ctype.h>
 #include <math.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <errno.h>
 #include "ssw.h"
 #include "kseq.h"
+#include "bgzf.h"
 
 #ifdef __GNUC__
 #define LIKELY(x) __builtin_expect((x),1)
@@ -30,8 +34,9 @@
   @discussion x will be modified.
  */
 #define kroundup32(x) (--(x), (x)|=(x)>>1, (x)|=(x)>>2, (x)|=(x)>>4, (x)|=(x)>>8, (x)|=(x)>>16, ++(x))
+#define kroundup64(x) (--(x), (x)|=(x)>>1, (x)|=(x)>>2, (x)|=(x)>>4, (x)|=(x)>>8, (x)|=(x)>>16, (x)|=(x)>>32, ++(x))
 
-KSEQ_INIT(gzFile, gzread)
+KSEQ_INIT(bgzf_file*, bgzf_read)
 
 void reverse_comple(const char* seq, char* rc) {
 	int32_t end = strlen(seq), start = 0;
@@ -56,38 +61,447 @@ void reverse_comple(const char* seq, char* rc) {
 	if (start == end) rc[start] = (char)rc_table[(int8_t)seq[start]];			
 }							
 
-void ssw_write (s_align* a, 
-			kseq_t* ref_seq,
-			kseq_t* read,
-			char* read_seq,	// strand == 0: original read; strand == 1: reverse complement read
+/* The reference contigs, loaded and translated once from a fasta file, or mapped from an index. */
+typedef struct {
+	int32_t n;
+	char** name;
+	char** seq;	// as read, for the output; 0: the output letters are taken from letter
+	int8_t** num;	// translated by the table, for the alignment
+	int32_t* len;
+	int64_t total;	// sum of len
+	const char* letter;	// number -> letter, when seq is 0
+	s_index* idx;	// 0: loaded from a fasta file
+} ref_set;
+
+#define ref_letter(r, j, i) ((r)->seq ? (r)->seq[j][i] : (r)->letter[(int)(r)->num[j][i]])
+
+static void ref_destroy (ref_set* r);
+
+static ref_set* ref_load (const char* path, const int8_t* table, int32_t threads) {
+	ref_set* r = (ref_set*)calloc(1, sizeof(ref_set));
+	bgzf_file* fp = bgzf_open(path, threads);
+	kseq_t* seq;
+	int32_t i, m;
+	if (! fp) {
+		free(r);
+		return 0;
+	}
+	seq = kseq_init(fp);
+	while (kseq_read(seq) >= 0) {
+		if ((r->n & (r->n - 1)) == 0) {
+			m = r->n ? r->n << 1 : 1;
+			r->name = (char**)realloc(r->name, m * sizeof(char*));
+			r->seq = (char**)realloc(r->seq, m * sizeof(char*));
+			r->num = (int8_t**)realloc(r->num, m * sizeof(int8_t*));
+			r->len = (int32_t*)realloc(r->len, m * sizeof(int32_t));
+		}
+		r->name[r->n] = strdup(seq->name.s);
+		r->seq[r->n] = strdup(seq->seq.s);
+		r->num[r->n] = (int8_t*)malloc(seq->seq.l + 1);
+		for (i = 0; i < (int32_t)seq->seq.l; ++i) r->num[r->n][i] = table[(int)seq->seq.s[i]];
+		r->len[r->n] = seq->seq.l;
+		r->total += seq->seq.l;
+		++ r->n;
+	}
+	kseq_destroy(seq);
+	if (bgzf_error(fp)) {
+		ref_destroy(r);
+		r = 0;
+	}
+	bgzf_close(fp);
+	return r;
+}
+
+/* Map the index written by "ssw_test index"; 0 if path is not an index. */
+static ref_set* ref_map (const char* path) {
+	ref_set* r;
+	s_index* idx = ssw_index_open(path);
+	int32_t i;
+	if (! idx) return 0;
+	r = (ref_set*)calloc(1, sizeof(ref_set));
+	r->n = idx->n;
+	r->name = (char**)idx->name;
+	r->num = (int8_t**)idx->seq;
+	r->len = (int32_t*)idx->len;
+	for (i = 0; i < r->n; ++i) r->total += r->len[i];
+	r->letter = idx->letter;
+	r->idx = idx;
+	return r;
+}
+
+/* Pick the letter written for each number: the most frequent one (upper case) in the contigs. */
+static void ref_letters (const ref_set* r, const int8_t* table, char* letter) {
+	int64_t* count = (int64_t*)calloc(128 * 128, sizeof(int64_t));
+	int64_t i;
+	int32_t j, c;
+	for (j = 0; j < r->n; ++j) 
+		for (i = 0; i < r->len[j]; ++i) ++count[r->num[j][i] * 128 + toupper((uint8_t)r->seq[j][i] & 0x7f)];
+	for (j = 0; j < 128; ++j) {
+		letter[j] = 0;
+		for (c = 0; c < 128; ++c) 
+			if (count[j * 128 + c] > 0 && (letter[j] == 0 || count[j * 128 + c] > count[j * 128 + letter[j]])) letter[j] = c;
+		for (c = 'A'; letter[j] == 0 && c <= 'Z'; ++c) if (table[c] == j) letter[j] = c;
+		if (letter[j] == 0) letter[j] = table['*'] == j ? '*' : 'N';
+	}
+	free(count);
+}
+
+static void ref_destroy (ref_set* r) {
+	int32_t i;
+	if (r->idx) {
+		ssw_index_close(r->idx);
+		free(r);
+		return;
+	}
+	for (i = 0; i < r->n; ++i) {
+		free(r->name[i]);
+		free(r->seq[i]);
+		free(r->num[i]);
+	}
+	free(r->name);
+	free(r->seq);
+	free(r->num);
+	free(r->len);
+	free(r);
+}
+
+/* Seeds: with -k, a read is only aligned to the windows of the contigs around the (w,k)-minimizers it shares with 
+   them, the k-mer of smallest hash out of each SEED_W consecutive ones. The minimizers of the reference are sorted 
+   by hash and bucketed by its high bits, about one per bucket, so that a k-mer is looked up in constant time. */
+#define SEED_W 10
+#define SEED_MAX_OCC 512	// minimizers found more often in the reference are repeats, not used as seeds
+
+typedef struct {
+	uint32_t h;	// hash of the k-mer
+	int32_t j, pos;	// contig and position of the k-mer
+} seed_hit;
+
+typedef struct {
+	int32_t k, bits;
+	int64_t n;
+	seed_hit* a;	// sorted by h
+	int64_t* off;	// a[off[b]] to a[off[b + 1] - 1]: the minimizers whose hash has b in its high bits
+} seed_index;
+
+typedef struct {
+	int32_t j, beg, end;	// window [beg, end) of contig j
+	int8_t strand;
+} seed_window;
+
+typedef struct {	// buffers of a worker
+	seed_hit* q;	// minimizers of the read
+	uint64_t* d;	// contig << 32 | diagonal + read length, of each seed
+	seed_window* w;
+	int64_t q_m, d_m;
+	int32_t w_n, w_m;
+} seed_buf;
+
+static inline uint32_t seed_hash (uint64_t key, uint64_t mask) {	// invertible on the bits of mask (T. Wang)
+	key = (~key + (key << 21)) & mask;
+	key = key ^ key >> 24;
+	key = ((key + (key << 3)) + (key << 8)) & mask;
+	key = key ^ key >> 14;
+	key = ((key + (key << 2)) + (key << 4)) & mask;
+	key = key ^ key >> 28;
+	key = (key + (key << 31)) & mask;
+	return (uint32_t)key;
+}
+
+/* Append the minimizers of the k-mers of s, l residues of contig j, to *a, which holds n of them and has room for *m; 
+   return the new n. N residues (4) end the k-mers. */
+static int64_t seed_minimizers (const int8_t* s, int32_t l, int32_t k, int32_t j, seed_hit** a, int64_t n, int64_t* m) {
+	uint64_t mask = (1ULL << 2 * k) - 1, kmer = 0;
+	seed_hit win[SEED_W];	// the last SEED_W k-mers, by position modulo SEED_W
+	int32_t i, t, len = 0, c = 0, min = 0, last = -1;	// len: residues of the current k-mer; c: k-mers since the last N
+
+	for (i = 0; i < l; ++i) {
+		int8_t out;
+		if (s[i] > 3) {
+			len = c = 0;
+			continue;
+		}
+		kmer = (kmer << 2 | s[i]) & mask;
+		if (++len < k) continue;
+		t = c % SEED_W;
+		out = c >= SEED_W && min == t;	// the minimizer leaves the window
+		win[t].h = seed_hash(kmer, mask);
+		win[t].j = j;
+		win[t].pos = i - k + 1;
+		if (out) {
+			for (min = 0, t = 1; t < SEED_W; ++t) 
+				if (win[t].h < win[min].h || (win[t].h == win[min].h && win[t].pos < win[min].pos)) min = t;
+		} else if (c == 0 || win[t].h < win[min].h) min = t;
+		if (++c >= SEED_W && win[min].pos != last) {	// a full window: its minimizer, once
+			if (n == *m) {
+				*m = *m ? *m * 2 : 64;
+				*a = (seed_hit*)realloc(*a, *m * sizeof(seed_hit));
+			}
+			(*a)[n++] = win[min];
+			last = win[min].pos;
+		}
+	}
+	return n;
+}
+
+static int seed_cmp (const void* x, const void* y) {
+	const seed_hit* a = (const seed_hit*)x, *b = (const seed_hit*)y;
+	if (a->h != b->h) return a->h < b->h ? -1 : 1;
+	if (a->j != b->j) return a->j < b->j ? -1 : 1;
+	return a->pos < b->pos ? -1 : a->pos > b->pos;
+}
+
+static int u64_cmp (const void* x, const void* y) {
+	uint64_t a = *(const uint64_t*)x, b = *(const uint64_t*)y;
+	return a < b ? -1 : a > b;
+}
+
+static int window_cmp (const void* x, const void* y) {
+	const seed_window* a = (const seed_window*)x, *b = (const seed_window*)y;
+	if (a->j != b->j) return a->j < b->j ? -1 : 1;
+	if (a->strand != b->strand) return a->strand - b->strand;
+	return a->beg < b->beg ? -1 : a->beg > b->beg;
+}
+
+static seed_index* seed_build (const ref_set* ref, int32_t k) {
+	seed_index* x = (seed_index*)calloc(1, sizeof(seed_index));
+	int64_t m = 0, i;
+	int32_t j;
+
+	x->k = k;
+	for (j = 0; j < ref->n; ++j) x->n = seed_minimizers(ref->num[j], ref->len[j], k, j, &x->a, x->n, &m);
+	if (x->n > 1) qsort(x->a, x->n, sizeof(seed_hit), seed_cmp);
+	for (x->bits = 1; x->bits < 2 * k && (1LL << x->bits) < x->n; ++x->bits);
+	x->off = (int64_t*)calloc((1LL << x->bits) + 1, sizeof(int64_t));
+	for (i = 0; i < x->n; ++i) ++ x->off[(x->a[i].h >> (2 * k - x->bits)) + 1];
+	for (i = 0; i < 1LL << x->bits; ++i) x->off[i + 1] += x->off[i];
+	return x;
+}
+
+static void seed_destroy (seed_index* x) {
+	free(x->a);
+	free(x->off);
+	free(x);
+}
+
+/* Return the minimizers of the reference with hash h, and set *n to their number. */
+static const seed_hit* seed_get (const seed_index* x, uint32_t h, int64_t* n) {
+	int64_t b = h >> (2 * x->k - x->bits), lo = x->off[b], hi = x->off[b + 1], e, mid;
+	while (lo < hi) {	// first with hash >= h
+		mid = (lo + hi) / 2;
+		if (x->a[mid].h < h) lo = mid + 1;
+		else hi = mid;
+	}
+	for (e = lo, hi = x->off[b + 1]; e < hi; ) {	// first with hash > h
+		mid = (e + hi) / 2;
+		if (x->a[mid].h <= h) e = mid + 1;
+		else hi = mid;
+	}
+	*n = e - lo;
+	return x->a + lo;
+}
+
+/* Add to b->w the windows of the reference where the read s of l residues may align on strand: the diagonals of the 
+   seeds of each contig, sorted, are grouped while they are less than l / 8 + 16 apart, for the indels, and each 
+   group is aligned to a window spanning the read on its diagonals, widened by l / 2 on both sides. */
+static void seed_windows (const seed_index* x, const ref_set* ref, const int8_t* s, int32_t l, int8_t strand, seed_buf* b) {
+	int64_t nq = seed_minimizers(s, l, x->k, 0, &b->q, 0, &b->q_m), nd = 0, i, e, c;
+	int32_t gap = l / 8 + 16, pad = l / 2;
+
+	for (i = 0; i < nq; ++i) {
+		const seed_hit* h = seed_get(x, b->q[i].h, &c);
+		if (c > SEED_MAX_OCC) continue;
+		for (; c > 0; --c, ++h) {
+			if (nd == b->d_m) {
+				b->d_m = b->d_m ? b->d_m * 2 : 64;
+				b->d = (uint64_t*)realloc(b->d, b->d_m * sizeof(uint64_t));
+			}
+			b->d[nd++] = (uint64_t)h->j << 32 | (uint32_t)(h->pos - b->q[i].pos + l);	// > 0
+		}
+	}
+	if (nd > 1) qsort(b->d, nd, sizeof(uint64_t), u64_cmp);
+	for (i = 0; i < nd; i = e) {
+		int32_t j = b->d[i] >> 32, lo = (int32_t)(uint32_t)b->d[i] - l, hi = lo, beg, end;
+		seed_window* w = b->w_n ? &b->w[b->w_n - 1] : 0;
+		for (e = i + 1; e < nd && (int32_t)(b->d[e] >> 32) == j && (int32_t)(uint32_t)b->d[e] - l - hi < gap; ++e) 
+			hi = (int32_t)(uint32_t)b->d[e] - l;
+		beg = lo > pad ? lo - pad : 0;
+		end = (int64_t)hi + l + pad < ref->len[j] ? hi + l + pad : ref->len[j];
+		if (w && w->j == j && w->strand == strand && beg <= w->end) {	// overlaps the previous one
+			if (end > w->end) w->end = end;
+			continue;
+		}
+		if (b->w_n == b->w_m) {
+			b->w_m = b->w_m ? b->w_m * 2 : 16;
+			b->w = (seed_window*)realloc(b->w, b->w_m * sizeof(seed_window));
+		}
+		w = &b->w[b->w_n++];
+		w->j = j;
+		w->beg = beg;
+		w->end = end;
+		w->strand = strand;
+	}
+}
+
+/* Mapping quality of the SAM and BAM records. */
+static uint32_t sam_mapq (const s_align2* a) {
+	uint32_t mapq = -4.343 * log(1 - (double)abs(a->score1 - a->score2)/(double)a->score1);
+	mapq = (uint32_t) (mapq + 4.99);
+	return mapq < 254 ? mapq : 254;
+}
+
+/* Number of mismatched and inserted or deleted bases (NM tag). */
+static int32_t sam_nm (const s_align2* a, const ref_set* ref, int32_t j, const char* read_seq, const int8_t* table) {
+	int32_t c, p, qb = a->ref_begin1, pb = a->read_begin1, nm = 0;
+	for (c = 0; c < a->cigarLen; ++c) {
+		int32_t letter = 0xf&*(a->cigar + c);
+		int32_t length = (0xfffffff0&*(a->cigar + c))>>4;
+		if (letter == 0) {
+			for (p = 0; p < length; ++p){ 
+				if (ref->num[j][qb] != table[(int)*(read_seq + pb)]) ++nm;
+				++qb;
+				++pb;
+			}
+		} else if (letter == 1) {
+			pb += length;
+			nm += length;
+		} else {
+			qb += length;
+			nm += length;
+		}
+	}
+	return nm;
+}
+
+static void put_le (FILE* out, uint32_t x, int32_t n) {	// n bytes, little endian
+	uint8_t b[4];
+	int32_t i;
+	for (i = 0; i < n; ++i) b[i] = x >> (i * 8);
+	fwrite(b, 1, n, out);
+}
+
+/* BAM bin of the 0-based region [beg, end). */
+static int32_t reg2bin (int32_t beg, int32_t end) {
+	--end;
+	if (beg>>14 == end>>14) return ((1<<15)-1)/7 + (beg>>14);
+	if (beg>>17 == end>>17) return ((1<<12)-1)/7 + (beg>>17);
+	if (beg>>20 == end>>20) return ((1<<9)-1)/7 + (beg>>20);
+	if (beg>>23 == end>>23) return ((1<<6)-1)/7 + (beg>>23);
+	if (beg>>26 == end>>26) return ((1<<3)-1)/7 + (beg>>26);
+	return 0;
+}
+
+/* The BAM header: the SAM header text and the reference contigs. */
+static void bam_header (FILE* out, const ref_set* ref) {
+	char* text;
+	size_t l_text;
+	FILE* t = open_memstream(&text, &l_text);
+	int32_t j;
+	fprintf(t, "@HD\tVN:1.4\tSO:queryname\n");
+	for (j = 0; j < ref->n; ++j) fprintf(t, "@SQ\tSN:%s\tLN:%d\n", ref->name[j], ref->len[j]);
+	fclose(t);
+	fwrite("BAM\1", 1, 4, out);
+	put_le(out, l_text, 4);
+	fwrite(text, 1, l_text, out);
+	put_le(out, ref->n, 4);
+	for (j = 0; j < ref->n; ++j) {
+		put_le(out, strlen(ref->name[j]) + 1, 4);
+		fwrite(ref->name[j], 1, strlen(ref->name[j]) + 1, out);
+		put_le(out, ref->len[j], 4);
+	}
+	free(text);
+}
+
+/* The BAM record of the SAM line written by ssw_write: the cigar of s_align2 is already in the BAM layout, and the 
+   bases are packed 4 bits each. */
+static void bam_write (FILE* out, 
+			const s_align2* a, 
+			const ref_set* ref, 
+			int32_t j, 
+			const char* read_name, 
+			const char* qual, 
+			const char* read_seq, 
+			const int8_t* table, 
+			int8_t strand) {
+	static const char code[] = "=ACMGRSVTWYHKDBN";
+	int32_t l_name = strlen(read_name) < 254 ? strlen(read_name) : 254;	// QNAME is at most 254 characters
+	int32_t c, p, l = 0, end = a->ref_begin1, mapped = a->score1 > 0;
+	if (mapped) {
+		l = a->read_end1 - a->read_begin1 + 1;
+		for (c = 0; c < a->cigarLen; ++c) if ((a->cigar[c] & 0xf) != 1) end += a->cigar[c] >> 4;
+	}
+	put_le(out, 32 + l_name + 1 + (mapped ? 4 * a->cigarLen : 0) + (l + 1) / 2 + l + (mapped ? 14 + (a->score2 > 0 ? 7 : 0) : 0), 4);
+	put_le(out, mapped ? j : -1, 4);	// refID
+	put_le(out, mapped ? a->ref_begin1 : -1, 4);	// pos
+	put_le(out, l_name + 1, 1);
+	put_le(out, mapped ? sam_mapq(a) : 255, 1);
+	put_le(out, mapped ? reg2bin(a->ref_begin1, end) : 4680, 2);
+	put_le(out, mapped ? a->cigarLen : 0, 2);
+	put_le(out, mapped ? (strand ? 16 : 0) : 4, 2);	// flag
+	put_le(out, l, 4);
+	put_le(out, -1, 4);	// next refID
+	put_le(out, -1, 4);	// next pos
+	put_le(out, 0, 4);	// tlen
+	fwrite(read_name, 1, l_name, out);
+	fputc(0, out);
+	if (! mapped) return;
+	for (c = 0; c < a->cigarLen; ++c) put_le(out, a->cigar[c], 4);
+	for (c = 0; c < l; c += 2) {
+		const char* b1 = strchr(code + 1, toupper((uint8_t)read_seq[a->read_begin1 + c]));
+		const char* b2 = c + 1 < l ? strchr(code + 1, toupper((uint8_t)read_seq[a->read_begin1 + c + 1])) : code;
+		fputc(((b1 && *b1 ? b1 - code : 15) << 4) | (b2 && *b2 ? b2 - code : 15), out);
+	}
+	for (c = 0, p = strand ? a->read_end1 : a->read_begin1; c < l; ++c, p += strand ? -1 : 1) 
+		fputc(qual ? qual[p] - 33 : 0xff, out);
+	fwrite("ASi", 1, 3, out);
+	put_le(out, a->score1, 4);
+	fwrite("NMi", 1, 3, out);
+	put_le(out, sam_nm(a, ref, j, read_seq, table), 4);
+	if (a->score2 > 0) {
+		fwrite("ZSi", 1, 3, out);
+		put_le(out, a->score2, 4);
+	}
+}
+
+void ssw_write (FILE* out,
+			s_align2* a, 
+			const ref_set* ref,
+			int32_t j,	// contig of ref
+			const char* read_name,
+			const char* qual,	// 0: no quality (fasta)
+			const char* read_seq,	// strand == 0: original read; strand == 1: reverse complement read
 			int8_t* table, 
 			int8_t strand,	// 0: forward aligned ; 1: reverse complement aligned 
-			int8_t sam) {	// 0: Blast like output; 1: Sam format output
+			int8_t sam) {	// 0: Blast like output; 1: Sam format output; 2: BAM records
+
+	if (sam == 2) {
+		bam_write(out, a, ref, j, read_name, qual, read_seq, table, strand);
+		return;
+	}
 
 	if (sam == 0) {	// Blast like output
-		fprintf(stdout, "target_name: %s\nquery_name: %s\noptimal_alignment_score: %d\t", ref_seq->name.s, read->name.s, a->score1);
-		if (a->score2 > 0) fprintf(stdout, "suboptimal_alignment_score: %d\t", a->score2);		
-		if (strand == 0) fprintf(stdout, "strand: +\t");
-		else fprintf(stdout, "strand: -\t");
-		if (a->ref_begin1 + 1) fprintf(stdout, "target_begin: %d\t", a->ref_begin1 + 1);
-		fprintf(stdout, "target_end: %d\t", a->ref_end1 + 1);
-		if (a->read_begin1 + 1) fprintf(stdout, "query_begin: %d\t", a->read_begin1 + 1);
-		fprintf(stdout, "query_end: %d\n\n", a->read_end1 + 1);
+		fprintf(out, "target_name: %s\nquery_name: %s\noptimal_alignment_score: %d\t", ref->name[j], read_name, a->score1);
+		if (a->score2 > 0) fprintf(out, "suboptimal_alignment_score: %d\t", a->score2);		
+		if (strand == 0) fprintf(out, "strand: +\t");
+		else fprintf(out, "strand: -\t");
+		if (a->ref_begin1 + 1) fprintf(out, "target_begin: %d\t", a->ref_begin1 + 1);
+		fprintf(out, "target_end: %d\t", a->ref_end1 + 1);
+		if (a->read_begin1 + 1) fprintf(out, "query_begin: %d\t", a->read_begin1 + 1);
+		fprintf(out, "query_end: %d\n\n", a->read_end1 + 1);
 		if (a->cigar) {
 			int32_t i, c = 0, left = 0, e = 0, qb = a->ref_begin1, pb = a->read_begin1;
 			while (e < a->cigarLen || left > 0) {
 				int32_t count = 0;
 				int32_t q = qb;
 				int32_t p = pb;
-				fprintf(stdout, "Target: %8d    ", q + 1);
+				fprintf(out, "Target: %8d    ", q + 1);
 				for (c = e; c < a->cigarLen; ++c) {
 					int32_t letter = 0xf&*(a->cigar + c);
 					int32_t length = (0xfffffff0&*(a->cigar + c))>>4;
 					int32_t l = (count == 0 && left > 0) ? left: length;
 					for (i = 0; i < l; ++i) {
-						if (letter == 1) fprintf(stdout, "-");
+						if (letter == 1) fprintf(out, "-");
 						else {
-							fprintf(stdout, "%c", *(ref_seq->seq.s + q));
+							fprintf(out, "%c", ref_letter(ref, j, q));
 							++ q;
 						}
 						++ count;
@@ -95,7 +509,7 @@ void ssw_write (s_align* a,
 					}
 				}
 step2:
-				fprintf(stdout, "    %d\n                    ", q);
+				fprintf(out, "    %d\n                    ", q);
 				q = qb;
 				count = 0;
 				for (c = e; c < a->cigarLen; ++c) {
@@ -104,12 +518,12 @@ step2:
 					int32_t l = (count == 0 && left > 0) ? left: length;
 					for (i = 0; i < l; ++i){ 
 						if (letter == 0) {
-							if (table[(int)*(ref_seq->seq.s + q)] == table[(int)*(read_seq + p)])fprintf(stdout, "|");
-							else fprintf(stdout, "*");
+							if (ref->num[j][q] == table[(int)*(read_seq + p)])fprintf(out, "|");
+							else fprintf(out, "*");
 							++q;
 							++p;
 						} else {
-							fprintf(stdout, "*");
+							fprintf(out, "*");
 							if (letter == 1) ++p;
 							else ++q;
 						}
@@ -122,16 +536,16 @@ step2:
 				}
 step3:
 				p = pb;
-				fprintf(stdout, "\nQuery:  %8d    ", p + 1);
+				fprintf(out, "\nQuery:  %8d    ", p + 1);
 				count = 0;
 				for (c = e; c < a->cigarLen; ++c) {
 					int32_t letter = 0xf&*(a->cigar + c);
 					int32_t length = (0xfffffff0&*(a->cigar + c))>>4;
 					int32_t l = (count == 0 && left > 0) ? left: length;
 					for (i = 0; i < l; ++i) { 
-						if (letter == 2) fprintf(stdout, "-");
+						if (letter == 2) fprintf(out, "-");
 						else {
-							fprintf(stdout, "%c", *(read_seq + p));
+							fprintf(out, "%c", *(read_seq + p));
 							++p;
 						}
 						++ count;
@@ -146,82 +560,381 @@ step3:
 				e = c;
 				left = 0;
 end:
-				fprintf(stdout, "    %d\n\n", p);
+				fprintf(out, "    %d\n\n", p);
 			}
 		}
 	}else {	// Sam format output
-		fprintf(stdout, "%s\t", read->name.s);
-		if (a->score1 == 0) fprintf(stdout, "4\t*\t0\t255\t*\t*\t0\t0\t*\t*\n");
+		fprintf(out, "%s\t", read_name);
+		if (a->score1 == 0) fprintf(out, "4\t*\t0\t255\t*\t*\t0\t0\t*\t*\n");
 		else {
-			int32_t c, l = a->read_end1 - a->read_begin1 + 1, qb = a->ref_begin1, pb = a->read_begin1, p;
-			uint32_t mapq = -4.343 * log(1 - (double)abs(a->score1 - a->score2)/(double)a->score1);
-			mapq = (uint32_t) (mapq + 4.99);
-			mapq = mapq < 254 ? mapq : 254;
-			if (strand) fprintf(stdout, "16\t");
-			else fprintf(stdout, "0\t");
-			fprintf(stdout, "%s\t%d\t%d\t", ref_seq->name.s, a->ref_begin1 + 1, mapq);
+			int32_t c, l = a->read_end1 - a->read_begin1 + 1, p;
+			uint32_t mapq = sam_mapq(a);
+			if (strand) fprintf(out, "16\t");
+			else fprintf(out, "0\t");
+			fprintf(out, "%s\t%d\t%d\t", ref->name[j], a->ref_begin1 + 1, mapq);
 			for (c = 0; c < a->cigarLen; ++c) {
 				int32_t letter = 0xf&*(a->cigar + c);
 				int32_t length = (0xfffffff0&*(a->cigar + c))>>4;
-				fprintf(stdout, "%d", length);
-				if (letter == 0) fprintf(stdout, "M");
-				else if (letter == 1) fprintf(stdout, "I");
-				else fprintf(stdout, "D");
+				fprintf(out, "%d", length);
+				if (letter == 0) fprintf(out, "M");
+				else if (letter == 1) fprintf(out, "I");
+				else fprintf(out, "D");
 			}
-			fprintf(stdout, "\t*\t0\t0\t");
-			for (c = a->read_begin1; c <= a->read_end1; ++c) fprintf(stdout, "%c", read_seq[c]);
-			fprintf(stdout, "\t");
-			if (read->qual.s && strand) {
+			fprintf(out, "\t*\t0\t0\t");
+			for (c = a->read_begin1; c <= a->read_end1; ++c) fprintf(out, "%c", read_seq[c]);
+			fprintf(out, "\t");
+			if (qual && strand) {
 				p = a->read_end1;
 				for (c = 0; c < l; ++c) {
-					fprintf(stdout, "%c", read->qual.s[p]);
+					fprintf(out, "%c", qual[p]);
 					--p;
 				}
-			}else if (read->qual.s){
+			}else if (qual){
 				p = a->read_begin1;
 				for (c = 0; c < l; ++c) {
-					fprintf(stdout, "%c", read->qual.s[p]);
+					fprintf(out, "%c", qual[p]);
 					++p;
 				}
-			} else fprintf(stdout, "*");
-			fprintf(stdout, "\tAS:i:%d", a->score1);
-			mapq = 0;	// counter of difference
-			for (c = 0; c < a->cigarLen; ++c) {
-				int32_t letter = 0xf&*(a->cigar + c);
-				int32_t length = (0xfffffff0&*(a->cigar + c))>>4;
-				if (letter == 0) {
-					for (p = 0; p < length; ++p){ 
-						if (table[(int)*(ref_seq->seq.s + qb)] != table[(int)*(read_seq + pb)]) ++mapq;
-						++qb;
-						++pb;
+			} else fprintf(out, "*");
+			fprintf(out, "\tAS:i:%d", a->score1);
+			fprintf(out,"\tNM:i:%d\t", sam_nm(a, ref, j, read_seq, table));
+			if (a->score2 > 0) fprintf(out, "ZS:i:%d\n", a->score2);
+			else fprintf(out, "\n");
+		}
+	}  
+}
+
+/* Reads are aligned by batches in three stages: the reader parses and encodes the reads into batches in input 
+   order, the workers align the batches in any order into their own output buffers, and the main thread writes 
+   the buffers back in input order. The stages pass the batches through bounded lock-free rings, and a fixed 
+   number of batches circulate, so the memory does not grow when one stage is slower than the others. */
+#define BATCH_READS 4096
+#define BATCH_CELLS 268435456	// read residues times reference residues per batch
+
+typedef struct {
+	size_t name, seq, qual, num;	// offsets in the data of the batch; qual == (size_t)-1: no quality
+	int32_t l;
+} query;
+
+typedef struct {
+	int64_t id;	// position in the input
+	query* q;
+	int32_t n, m;
+	int8_t error;
+	char* data;	// names, letters, qualities and numbers of the reads
+	size_t data_l, data_m;
+	char* out;	// output of the batch
+	size_t out_l;
+} batch;
+
+#define query_str(b, q, f) ((b)->data + (q)->f)
+
+/* Bounded multi-producer multi-consumer queue (D. Vyukov): cell i can be written for the turn t when its 
+   sequence number is t, and read when it is t + 1. */
+typedef struct {
+	int64_t seq;
+	batch* b;
+} ring_cell;
+
+typedef struct {
+	ring_cell* cell;
+	int64_t mask;
+	int64_t head __attribute__((aligned(64)));	// next turn to write
+	int64_t tail __attribute__((aligned(64)));	// next turn to read
+} ring;
+
+static void ring_init (ring* r, int32_t size) {	// size: a power of 2
+	int32_t i;
+	r->cell = (ring_cell*)calloc(size, sizeof(ring_cell));
+	for (i = 0; i < size; ++i) r->cell[i].seq = i;
+	r->mask = size - 1;
+	r->head = r->tail = 0;
+}
+
+/* Wait for another stage: spin first, then yield, then sleep. */
+static void backoff (int32_t* k) {
+	if (++ *k < 64) return;
+	if (*k < 128) sched_yield();
+	else {
+		struct timespec t = {0, 100000};
+		nanosleep(&t, 0);
+	}
+}
+
+static void ring_put (ring* r, batch* b) {
+	int32_t k = 0;
+	int64_t t = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+	for (;;) {
+		ring_cell* c = &r->cell[t & r->mask];
+		int64_t d = __atomic_load_n(&c->seq, __ATOMIC_ACQUIRE) - t;
+		if (d == 0) {
+			if (__atomic_compare_exchange_n(&r->head, &t, t + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+				c->b = b;
+				__atomic_store_n(&c->seq, t + 1, __ATOMIC_RELEASE);
+				return;
+			}
+		} else if (d < 0) {	// full
+			backoff(&k);
+			t = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+		} else t = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+	}
+}
+
+static batch* ring_get (ring* r) {
+	int32_t k = 0;
+	int64_t t = __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+	for (;;) {
+		ring_cell* c = &r->cell[t & r->mask];
+		int64_t d = __atomic_load_n(&c->seq, __ATOMIC_ACQUIRE) - (t + 1);
+		if (d == 0) {
+			if (__atomic_compare_exchange_n(&r->tail, &t, t + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+				batch* b = c->b;
+				__atomic_store_n(&c->seq, t + r->mask + 1, __ATOMIC_RELEASE);
+				return b;
+			}
+		} else if (d < 0) {	// empty
+			backoff(&k);
+			t = __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+		} else t = __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+	}
+}
+
+typedef struct {
+	// alignment settings, read only once the threads are started
+	const ref_set* ref;
+	const int8_t* mat;
+	int8_t* table;
+	int32_t n, gap_open, gap_extension, filter, threads;
+	int8_t flag, reverse, sam;
+	const seed_index* seeds;	// 0: the reads are aligned to the whole contigs
+	kseq_t* read_seq;
+
+	ring free, read, aligned;	// reader -> workers -> writer -> reader; 0 ends a stage
+	int32_t abort;
+} pipeline;
+
+typedef struct {
+	pipeline* pl;
+	pthread_t tid;
+	int64_t reads;
+} worker;
+
+static double wall_time (void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static size_t batch_add (batch* b, const void* s, size_t l) {
+	size_t o = b->data_l;
+	if (b->data_l + l > b->data_m) {
+		b->data_m = b->data_l + l;
+		kroundup64(b->data_m);
+		b->data = (char*)realloc(b->data, b->data_m);
+	}
+	if (s) memcpy(b->data + o, s, l);
+	b->data_l += l;
+	return o;
+}
+
+static void* read_batches (void* data) {
+	pipeline* pl = (pipeline*)data;
+	kseq_t* r = pl->read_seq;
+	int64_t k;
+	int32_t i;
+	int8_t eof = 0;
+	for (k = 0; ! eof && ! __atomic_load_n(&pl->abort, __ATOMIC_RELAXED); ++k) {
+		batch* b = ring_get(&pl->free);
+		int64_t cells = 0;
+		b->id = k;
+		b->n = 0;
+		b->data_l = 0;
+		b->error = 0;
+		while (b->n < BATCH_READS && cells < BATCH_CELLS) {
+			query* q;
+			int8_t* num;
+			if (kseq_read(r) < 0) {
+				eof = 1;
+				break;
+			}
+			if (b->n == b->m) {
+				b->m = b->m ? b->m << 1 : 16;
+				b->q = (query*)realloc(b->q, b->m * sizeof(query));
+			}
+			q = &b->q[b->n++];
+			q->l = r->seq.l;
+			q->name = batch_add(b, r->name.s, r->name.l + 1);
+			q->seq = batch_add(b, r->seq.s, r->seq.l + 1);
+			q->qual = r->qual.s ? batch_add(b, r->qual.s, r->qual.l + 1) : (size_t)-1;
+			q->num = batch_add(b, 0, r->seq.l);
+			num = (int8_t*)query_str(b, q, num);
+			for (i = 0; i < q->l; ++i) num[i] = pl->table[(int)r->seq.s[i]];
+			cells += (int64_t)q->l * pl->ref->total;
+		}
+		if (b->n > 0) ring_put(&pl->read, b);
+		else ring_put(&pl->free, b);
+	}
+	for (i = 0; i < pl->threads; ++i) ring_put(&pl->read, 0);
+	return 0;
+}
+
+/* Align the read of p, and of p_rc if not 0, to its windows in sb (see seed_windows) and write the best alignment in 
+   each contig they are in, with its positions in the contig. Return 0 on error. */
+static int8_t align_windows (const pipeline* pl, s_workspace* ws, const seed_buf* sb, FILE* out, const s_profile* p, 
+							 const s_profile* p_rc, int32_t readLen, const char* name, const char* qual, const char* seq, 
+							 const char* read_rc) {
+	int32_t i, e, s, maskLen = readLen / 2;
+
+	for (i = 0; i < sb->w_n; i = e) {	// the windows of contig j, forward strand first, by position
+		int32_t j = sb->w[i].j, second[2] = {0, 0}, end2[2] = {-1, -1};
+		s_align2* best[2] = {0, 0};
+		for (e = i; e < sb->w_n && sb->w[e].j == j; ++e) {
+			const seed_window* w = &sb->w[e];
+			s_align2* a = ssw_align2_ws(ws, w->strand ? p_rc : p, pl->ref->num[j] + w->beg, w->end - w->beg, pl->gap_open, 
+										pl->gap_extension, pl->flag, pl->filter, 0, maskLen);
+			if (! a) {
+				if (best[0]) align2_destroy(best[0]);
+				if (best[1]) align2_destroy(best[1]);
+				return 0;
+			}
+			a->ref_end1 += w->beg;
+			if (a->ref_begin1 >= 0) a->ref_begin1 += w->beg;
+			if (a->ref_end2 >= 0) a->ref_end2 += w->beg;
+			s = w->strand;
+			if (best[s] && a->score1 > best[s]->score1) {	// the best of the other windows is the 2nd best of a
+				s_align2* t = best[s];
+				best[s] = a;
+				a = t;
+			}
+			if (! best[s]) best[s] = a;
+			else {
+				if (a->score1 > second[s]) {
+					second[s] = a->score1;
+					end2[s] = a->ref_end1;
+				}
+				align2_destroy(a);
+			}
+		}
+		for (s = 0; s < 2; ++s) {
+			if (best[s] && second[s] > best[s]->score2) {
+				best[s]->score2 = second[s];
+				best[s]->ref_end2 = end2[s];
+			}
+		}
+		s = best[1] && (! best[0] || best[1]->score1 > best[0]->score1);
+		if (best[s]->score1 >= pl->filter) 
+			ssw_write(out, best[s], pl->ref, j, name, qual, s ? read_rc : seq, pl->table, s, pl->sam);
+		if (best[0]) align2_destroy(best[0]);
+		if (best[1]) align2_destroy(best[1]);
+	}
+	return 1;
+}
+
+static void* align_batches (void* data) {
+	worker* w = (worker*)data;
+	pipeline* pl = w->pl;
+	s_workspace* ws = workspace_init();
+	int32_t m, s2 = 128;
+	int8_t* num_rc = (int8_t*)malloc(s2);
+	char* read_rc = (char*)malloc(s2);
+	seed_buf sb;
+	batch* b;
+
+	memset(&sb, 0, sizeof(seed_buf));
+
+	while ((b = ring_get(&pl->read)) != 0) {
+		FILE* out = open_memstream(&b->out, &b->out_l);
+		int32_t i, j;
+		for (i = 0; i < b->n && ! b->error && ! __atomic_load_n(&pl->abort, __ATOMIC_RELAXED); ++i) {
+			query* r = &b->q[i];
+			const char* seq = query_str(b, r, seq), *qual = r->qual == (size_t)-1 ? 0 : query_str(b, r, qual);
+			s_profile* p, *p_rc = 0;
+			int32_t readLen = r->l;	
+			int32_t maskLen = readLen / 2; 
+
+			while (readLen >= s2) {
+				++s2;
+				kroundup32(s2);
+				read_rc = (char*)realloc(read_rc, s2);
+				num_rc = (int8_t*)realloc(num_rc, s2);
+			}
+			p = ssw_init((int8_t*)query_str(b, r, num), readLen, pl->mat, pl->n, 2);
+			if (pl->reverse == 1 && pl->n == 5) {
+				reverse_comple(seq, read_rc);
+				for (m = 0; m < readLen; ++m) num_rc[m] = pl->table[(int)read_rc[m]];
+				p_rc = ssw_init(num_rc, readLen, pl->mat, pl->n, 2);
+			}
+
+			if (pl->seeds) {
+				sb.w_n = 0;
+				seed_windows(pl->seeds, pl->ref, (int8_t*)query_str(b, r, num), readLen, 0, &sb);
+				if (p_rc) seed_windows(pl->seeds, pl->ref, num_rc, readLen, 1, &sb);
+				if (sb.w_n > 1) qsort(sb.w, sb.w_n, sizeof(seed_window), window_cmp);
+				if (! align_windows(pl, ws, &sb, out, p, p_rc, readLen, query_str(b, r, name), qual, seq, read_rc)) b->error = 1;
+			} else {
+				for (j = 0; j < pl->ref->n; ++j) {
+					int8_t strand;
+					int32_t scores[2];
+					// both strands in one scan of the reference
+					s_align2* result = ssw_align2_dual (ws, p, p_rc, pl->ref->num[j], pl->ref->len[j], pl->gap_open, pl->gap_extension, pl->flag, pl->filter, 0, maskLen, &strand, scores);
+					if (! result) {
+						b->error = 1;
+						break;
 					}
-				} else if (letter == 1) {
-					pb += length;
-					mapq += length;
-				} else {
-					qb += length;
-					mapq += length;
+					if (result->score1 >= pl->filter) 
+						ssw_write (out, result, pl->ref, j, query_str(b, r, name), qual, strand ? read_rc : seq, pl->table, strand, pl->sam);
+					align2_destroy(result);
 				}
 			}
-			fprintf(stdout,"\tNM:i:%d\t", mapq);
-			if (a->score2 > 0) fprintf(stdout, "ZS:i:%d\n", a->score2);
-			else fprintf(stdout, "\n");
+
+			if(p_rc) init_destroy(p_rc);
+			init_destroy(p);
+			++ w->reads;
 		}
-	}  
+		fclose(out);
+		ring_put(&pl->aligned, b);
+	}
+	ring_put(&pl->aligned, 0);
+
+	workspace_destroy(ws);
+	free(read_rc);
+	free(num_rc);
+	free(sb.q);
+	free(sb.d);
+	free(sb.w);
+	return 0;
+}
+
+static int32_t write_all (int fd, const char* s, size_t l) {
+	while (l > 0) {
+		ssize_t k = write(fd, s, l);
+		if (k < 0 && errno == EINTR) continue;
+		if (k <= 0) return -1;
+		s += k;
+		l -= k;
+	}
+	return 0;
 }
 
 int main (int argc, char * const argv[]) {
 	clock_t start, end;
 	float cpu_time;
-	gzFile read_fp, ref_fp;
-	kseq_t *read_seq, *ref_seq;
-	int32_t l, m, k, match = 2, mismatch = 2, gap_open = 3, gap_extension = 1, path = 0, reverse = 0, n = 5, sam = 0, protein = 0, header = 0, s1 = 67108864, s2 = 128, filter = 0;
+	double wall_start, wall;
+	bgzf_file* read_fp;
+	kseq_t *read_seq;
+	ref_set* ref;
+	int32_t l, m, k, match = 2, mismatch = 2, gap_open = 3, gap_extension = 1, path = 0, reverse = 0, n = 5, sam = 0, protein = 0, header = 0, filter = 0, threads = 1, error = 0, indexing = 0, seed = 0;
 	int8_t* mata = (int8_t*)calloc(25, sizeof(int8_t)), *mat = mata;
 	char mat_name[16];
 	mat_name[0] = '\0';
-	int8_t* ref_num = (int8_t*)malloc(s1);
-	int8_t* num = (int8_t*)malloc(s2), *num_rc = 0;
-	char* read_rc = 0;
+	pipeline pl;
+	worker* w;
+	pthread_t reader;
+	batch* bt, **pending;
+	int64_t b;
+	int32_t nb;
+	bgzf_writer* bam = 0;
+	char* bam_head;
 
 	int8_t mat50[] = {
 	//  A   R   N   D   C   Q   E   G   H   I   L   K   M   F   P   S   T   W   Y   V   B   Z   X   *   
@@ -277,8 +990,13 @@ int main (int argc, char * const argv[]) {
 	
 	int8_t* table = nt_table;
 
-	// Parse command line.
-	while ((l = getopt(argc, argv, "m:x:o:e:a:f:pcrsh")) >= 0) {
+	// Parse command line; "ssw_test index" takes the same options, followed by the target only.
+	if (argc > 1 && ! strcmp(argv[1], "index")) {
+		indexing = 1;
+		-- argc;
+		++ argv;
+	}
+	while ((l = getopt(argc, argv, "m:x:o:e:a:f:t:k:pcrsbh")) >= 0) {
 		switch (l) {
 			case 'm': match = atoi(optarg); break;
 			case 'x': mismatch = atoi(optarg); break;
@@ -286,16 +1004,21 @@ int main (int argc, char * const argv[]) {
 			case 'e': gap_extension = atoi(optarg); break;
 			case 'a': strcpy(mat_name, optarg); break;
 			case 'f': filter = atoi(optarg); break;
+			case 't': threads = atoi(optarg); break;
+			case 'k': seed = atoi(optarg); break;
 			case 'p': protein = 1; break;
 			case 'c': path = 1; break;
 			case 'r': reverse = 1; break;
 			case 's': sam = 1; break;
+			case 'b': sam = 2; break;
 			case 'h': header = 1; break;
 		}
 	}
-	if (optind + 2 > argc) {
+	if (optind + 2 - indexing > argc || threads < 1 || (seed && (seed < 4 || seed > 16))) {
 		fprintf(stderr, "\n");
-		fprintf(stderr, "Usage: ssw_test [options] ... <target.fasta> <query.fasta>(or <query.fastq>)\n");	
+		fprintf(stderr, "Usage: ssw_test [options] ... <target.fasta>(or <target.fasta.sswi>) <query.fasta>(or <query.fastq>)\n");	
+		fprintf(stderr, "       ssw_test index [-p] [-a FILE] <target.fasta>\n");	
+		fprintf(stderr, "       (writes the target encoded for the -p and -a options into <target.fasta.sswi>, which is then mapped instead of read)\n");	
 		fprintf(stderr, "Options:\n");
 		fprintf(stderr, "\t-m N\tN is a positive integer for weight match in genome sequence alignment. [default: 2]\n");
 		fprintf(stderr, "\t-x N\tN is a positive integer. -N will be used as weight mismatch in genome sequence alignment. [default: 2]\n");
@@ -305,8 +1028,12 @@ int main (int argc, char * const argv[]) {
 		fprintf(stderr, "\t-a FILE\tFILE is either the Blosum or Pam weight matrix. [default: Blosum50]\n"); 
 		fprintf(stderr, "\t-c\tReturn the alignment path.\n");
 		fprintf(stderr, "\t-f N\tN is a positive integer. Only output the alignments with the Smith-Waterman score >= N.\n");
+		fprintf(stderr, "\t-t N\tN is the number of alignment threads; the output is in the same order as with one thread. [default: 1]\n");
+		fprintf(stderr, "\t-k N\tAlign each read only around the minimizers of N-mers (4 <= N <= 16) it shares with the target, in windows\n");
+		fprintf(stderr, "\t\tof the contigs; a contig without any is not aligned. Only for genome sequences. [default: whole contigs]\n");
 		fprintf(stderr, "\t-r\tThe best alignment will be picked between the original read alignment and the reverse complement read alignment.\n");
 		fprintf(stderr, "\t-s\tOutput in SAM format. [default: no header]\n");
+		fprintf(stderr, "\t-b\tOutput in BAM format, with the header, compressed by as many threads as given with -t. Only with -c, for genome sequences.\n");
 		fprintf(stderr, "\t-h\tIf -s is used, include header in SAM output.\n\n");
 		return 1;
 	}
@@ -365,96 +1092,155 @@ int main (int argc, char * const argv[]) {
 		mat = mata;
 	}
 
-	read_fp = gzopen(argv[optind + 1], "r");
+	// load and translate the reference once, or map its index; it is shared by the alignment threads
+	ref = indexing ? 0 : ref_map(argv[optind]);
+	if (ref && memcmp(ref->idx->table, table, 128)) {
+		fprintf(stderr, "The index was written for other -p and -a options.\n");
+		return 1;
+	}
+	if (! ref) ref = ref_load(argv[optind], table, threads);
+	if (! ref) {
+		fprintf(stderr, "Problem of reading the reference file.\n");
+		return 1;
+	}
+	if (indexing) {
+		char* index_name = (char*)malloc(strlen(argv[optind]) + 6);
+		char letter[128];
+		ref_letters(ref, table, letter);
+		sprintf(index_name, "%s.sswi", argv[optind]);
+		if (ssw_index_write(index_name, ref->n, (const char* const*)ref->name, (const int8_t* const*)ref->num, ref->len, table, letter)) {
+			fprintf(stderr, "Problem of writing %s.\n", index_name);
+			return 1;
+		}
+		fprintf(stderr, "%d sequences (%ld residues) written to %s.\n", ref->n, (long)ref->total, index_name);
+		free(index_name);
+		ref_destroy(ref);
+		free(mata);
+		return 0;
+	}
+
+	read_fp = bgzf_open(argv[optind + 1], threads);	// the BGZF blocks are inflated by as many threads as the alignment
+	if (! read_fp) {
+		fprintf(stderr, "Problem of opening the query file.\n");
+		return 1;
+	}
 	read_seq = kseq_init(read_fp);
-	if (sam && header && path) {
+	if (sam == 2 && (! path || n != 5)) {
+		fprintf(stderr, "BAM format output is only available together with option -c, for genome sequences.\n");
+		return 1;
+	} else if (sam == 2) {
+		size_t l_head;
+		FILE* h = open_memstream(&bam_head, &l_head);
+		bam = bgzf_wopen(STDOUT_FILENO, threads);
+		bam_header(h, ref);
+		fclose(h);
+		bgzf_write(bam, bam_head, l_head);
+		free(bam_head);
+	} else if (sam && header && path) {
 		fprintf(stdout, "@HD\tVN:1.4\tSO:queryname\n");
-		ref_fp = gzopen(argv[optind], "r");
-		ref_seq = kseq_init(ref_fp);
-		while ((l = kseq_read(ref_seq)) >= 0) fprintf(stdout, "@SQ\tSN:%s\tLN:%d\n", ref_seq->name.s, (int32_t)ref_seq->seq.l);
-		kseq_destroy(ref_seq);
-		gzclose(ref_fp);
+		for (k = 0; k < ref->n; ++k) fprintf(stdout, "@SQ\tSN:%s\tLN:%d\n", ref->name[k], ref->len[k]);
 	} else if (sam && !path) {
 		fprintf(stderr, "SAM format output is only available together with option -c.\n");
 		sam = 0;
 	}
 
-	// alignment
-	if (reverse == 1 && n == 5) {
-		read_rc = (char*)malloc(s2);
-		num_rc = (int8_t*)malloc(s2);
+	if (reverse == 1 && n == 24) {
+		fprintf (stderr, "Reverse complement alignment is not available for protein sequences. \n");
+		return 1;
+	}
+	if (seed && n != 5) {
+		fprintf (stderr, "Seeding is not available for protein sequences. \n");
+		return 1;
 	}
+
+	// alignment
+	memset(&pl, 0, sizeof(pipeline));
+	pl.ref = ref;
+	pl.mat = mat;
+	pl.table = table;
+	pl.n = n;
+	pl.gap_open = gap_open;
+	pl.gap_extension = gap_extension;
+	pl.filter = filter;
+	if (path == 1) pl.flag = 2;
+	if (filter > 0) pl.flag |= 0x20;	// the alignments below filter are not written, so they can be abandoned early
+	pl.reverse = reverse;
+	pl.sam = sam;
+	pl.seeds = seed ? seed_build(ref, seed) : 0;
+	pl.read_seq = read_seq;
+	pl.threads = threads;
+	nb = 4 * threads;	// batches in circulation
+	m = nb + threads + 1;	// room for all the batches and the ends of the stages, so that no ring is ever full
+	kroundup32(m);
+	ring_init(&pl.free, m);
+	ring_init(&pl.read, m);
+	ring_init(&pl.aligned, m);
+	bt = (batch*)calloc(nb, sizeof(batch));
+	for (m = 0; m < nb; ++m) ring_put(&pl.free, &bt[m]);
+	pending = (batch**)calloc(nb, sizeof(batch*));
+	w = (worker*)calloc(threads, sizeof(worker));
+	fflush(stdout);	// the header; the records are written with write
+
 	start = clock();
-	while (kseq_read(read_seq) >= 0) {
-		s_profile* p, *p_rc = 0;
-		int32_t readLen = read_seq->seq.l;	
-		int32_t maskLen = readLen / 2; 
-	//	int32_t maskLen = 2*readLen;	
-
-		while (readLen >= s2) {
-			++s2;
-			kroundup32(s2);
-			num = (int8_t*)realloc(num, s2);
-			if (reverse == 1 && n == 5) {
-				read_rc = (char*)realloc(read_rc, s2);
-				num_rc = (int8_t*)realloc(num_rc, s2);
-			}
-		}
-		for (m = 0; m < readLen; ++m) num[m] = table[(int)read_seq->seq.s[m]];
-		p = ssw_init(num, readLen, mat, n, 2);
-		if (reverse == 1 && n == 5) {
-			reverse_comple(read_seq->seq.s, read_rc);
-			for (m = 0; m < readLen; ++m) num_rc[m] = table[(int)read_rc[m]];
-			p_rc = ssw_init(num_rc, readLen, mat, n, 2);
-		}else if (reverse == 1 && n == 24) {
-			fprintf (stderr, "Reverse complement alignment is not available for protein sequences. \n");
-			return 1;
+	wall_start = wall_time();
+	pthread_create(&reader, 0, read_batches, &pl);
+	for (l = 0; l < threads; ++l) {
+		w[l].pl = &pl;
+		pthread_create(&w[l].tid, 0, align_batches, &w[l]);
+	}
+	for (b = 0, k = 0; k < threads; ) {	// write the batches in input order
+		batch* d = ring_get(&pl.aligned);
+		if (d == 0) {	// a worker is done
+			++ k;
+			continue;
 		}
-
-		ref_fp = gzopen(argv[optind], "r");
-		ref_seq = kseq_init(ref_fp);
-		while (kseq_read(ref_seq) >= 0) {
-			s_align* result, *result_rc = 0;
-			int32_t refLen = ref_seq->seq.l; 
-			int8_t flag = 0;
-			while (refLen > s1) {
-				++s1;
-				kroundup32(s1);
-				ref_num = (int8_t*)realloc(ref_num, s1);
+		pending[d->id % nb] = d;	// the batches in flight are less than nb apart
+		while ((d = pending[b % nb]) && d->id == b) {
+			pending[b % nb] = 0;
+			if (! error && (bam ? bgzf_write(bam, d->out, d->out_l) : write_all(STDOUT_FILENO, d->out, d->out_l))) {
+				fprintf(stderr, "Problem of writing the output.\n");
+				error = 1;
 			}
-			for (m = 0; m < refLen; ++m) ref_num[m] = table[(int)ref_seq->seq.s[m]];
-			if (path == 1) flag = 2;
-			result = ssw_align (p, ref_num, refLen, gap_open, gap_extension, flag, filter, 0, maskLen);
-			if (reverse == 1 && protein == 0) 
-				result_rc = ssw_align(p_rc, ref_num, refLen, gap_open, gap_extension, flag, filter, 0, maskLen);
-			if (result_rc && result_rc->score1 > result->score1 && result_rc->score1 >= filter) {
-				if (sam) ssw_write (result_rc, ref_seq, read_seq, read_rc, table, 1, 1);
-				else ssw_write (result_rc, ref_seq, read_seq, read_rc, table, 1, 0);
-			}else if (result && result->score1 >= filter){
-				if (sam) ssw_write(result, ref_seq, read_seq, read_seq->seq.s, table, 0, 1);
-				else ssw_write(result, ref_seq, read_seq, read_seq->seq.s, table, 0, 0);
-			} else if (! result) return 1;
-			if (result_rc) align_destroy(result_rc);
-			align_destroy(result);
+			if (d->error) error = 1;
+			if (error) __atomic_store_n(&pl.abort, 1, __ATOMIC_RELAXED);
+			free(d->out);
+			d->out = 0;
+			ring_put(&pl.free, d);
+			++ b;
 		}
-		
-		if(p_rc) init_destroy(p_rc);
-		init_destroy(p);
-		kseq_destroy(ref_seq);
-		gzclose(ref_fp);
+	}
+	pthread_join(reader, 0);
+	for (l = 0; l < threads; ++l) pthread_join(w[l].tid, 0);
+	if (bam && bgzf_wclose(bam) && ! error) {
+		fprintf(stderr, "Problem of writing the output.\n");
+		error = 1;
+	}
+	if (bgzf_error(read_fp)) {
+		fprintf(stderr, "Problem of reading the query file.\n");
+		error = 1;
 	}
 	end = clock();
+	wall = wall_time() - wall_start;
 	cpu_time = ((float) (end - start)) / CLOCKS_PER_SEC;
 	fprintf(stderr, "CPU time: %f seconds\n", cpu_time);
+	fprintf(stderr, "Wall-clock time: %f seconds\n", wall);
+	for (l = 0; l < threads; ++l) 
+		fprintf(stderr, "Thread %d: %ld reads, %.2f reads per second\n", l + 1, (long)w[l].reads, wall > 0 ? w[l].reads / wall : 0);
 
-	if (num_rc) {
-		free(num_rc);
-		free(read_rc);
+	for (m = 0; m < nb; ++m) {
+		free(bt[m].q);
+		free(bt[m].data);
 	}
+	free(bt);
+	free(pending);
+	free(pl.free.cell);
+	free(pl.read.cell);
+	free(pl.aligned.cell);
+	free(w);
+	if (pl.seeds) seed_destroy((seed_index*)pl.seeds);
+	ref_destroy(ref);
 	kseq_destroy(read_seq);
-	gzclose(read_fp);
-	free(num);
-	free(ref_num);
+	bgzf_close(read_fp);
  	free(mata);
-	return 0;
+	return error;
 }
@@ -42,15 +42,30 @@
 #include <string.h>
 #include <math.h>
 #include "ssw.h"
+#ifdef SSW_INDEX
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 
 #ifdef __GNUC__
 #define LIKELY(x) __builtin_expect((x),1)
 #define UNLIKELY(x) __builtin_expect((x),0)
+#define SSW_LAZY_WORD	/* the atomics of profile_word_get; without them, ssw_init builds the 16-bit profiles */
 #else
 #define LIKELY(x) (x)
 #define UNLIKELY(x) (x)
 #endif
 
+/* The 256-bit kernels are compiled with a function level target attribute, so the rest of the file still only 
+   requires SSE2; ssw_init picks the kernel width once at run time from CPUID. Define SSW_NO_AVX2 to leave them out. */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && !defined(SSW_NO_AVX2)
+#define SSW_AVX2
+#include <immintrin.h>
+#define SSW_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
 /* Convert the coordinate in the scoring matrix into the coordinate in one line of the band. */
 #define set_u(u, w, i, j) { int x=(i)-(w); x=x>0?x:0; (u)=(j)-x+1; }
 
@@ -65,7 +80,7 @@
 #define kroundup32(x) (--(x), (x)|=(x)>>1, (x)|=(x)>>2, (x)|=(x)>>4, (x)|=(x)>>8, (x)|=(x)>>16, ++(x))
 
 typedef struct {
-	uint16_t score;
+	int32_t score;
 	int32_t ref;	 //0-based position 
 	int32_t read;    //alignment ending position on read, 0-based 
 } alignment_end;
@@ -78,25 +93,190 @@ typedef struct {
 struct _profile{
 	__m128i* profile_byte;	// 0: none
 	__m128i* profile_word;	// 0: none
+	__m128i* profile_byte_rev;	// profiles of the reversed read, for the reverse pass (see profile_tail)
+	__m128i* profile_word_rev;
 	const int8_t* read;
 	const int8_t* mat;
 	int32_t readLen;
 	int32_t n;
 	uint8_t bias;
+	uint8_t avx2;	// 1: the profiles are in the 256-bit layout of qP_byte_avx2/qP_word_avx2
+	uint8_t lazy;	// 1: score_size 2; profile_word and profile_word_rev are built at their first use (see profile_word_get)
+	int32_t max_mat;	// largest score of mat
+};
+
+/* Buffers of the workspace; each is used by one step of an alignment at a time. */
+enum {
+	WS_H_STORE, WS_H_LOAD, WS_E, WS_F, WS_H_MAX, WS_MASK,	// columns of the striped kernels
+	WS_MAX_COLUMN, WS_BESTS,
+	WS_READ_REVERSE, WS_PROFILE, WS_TAIL_MASK,	// reverse pass
+	WS_DIR,	// direction bits of align_trace
+	WS_BAND_PROFILE, WS_BAND_PROFILE32, WS_BAND_H_B, WS_BAND_H_C, WS_BAND_E_B, WS_BAND_DIR, WS_BAND_CHECKS, WS_CIGAR,
+	WS_DUAL_H_STORE, WS_DUAL_H_LOAD, WS_DUAL_E, WS_DUAL_H_MAX, WS_DUAL_MAX_COLUMN,	// second read of the dual kernels
+	WS_SSE2_BYTE, WS_SSE2_WORD, WS_SSE2_BYTE_REV, WS_SSE2_WORD_REV,	// profiles of profile_sse2
+	WS_NUM
+};
+
+struct _workspace {
+	void* buf[WS_NUM];
+	size_t size[WS_NUM];
 };
 
+/* Return buffer slot of ws with room for size bytes, 32-byte aligned. It only grows, keeping its content as realloc 
+   does; 0 if it cannot be allocated. */
+static void* ws_get (s_workspace* ws, int32_t slot, size_t size) {
+	if (UNLIKELY(size > ws->size[slot] || ws->buf[slot] == 0)) {
+		size_t s = ws->size[slot] * 2 > size ? ws->size[slot] * 2 : size < 64 ? 64 : size;
+		void* buf = _mm_malloc(s, 32);
+		if (UNLIKELY(buf == 0)) return 0;
+		if (ws->buf[slot]) {
+			memcpy(buf, ws->buf[slot], ws->size[slot]);
+			_mm_free(ws->buf[slot]);
+		}
+		ws->buf[slot] = buf;
+		ws->size[slot] = s;
+	}
+	return ws->buf[slot];
+}
+
+/* ws_get with the first size bytes set to 0. */
+static void* ws_calloc (s_workspace* ws, int32_t slot, size_t size) {
+	void* buf = ws_get(ws, slot, size);
+	if (LIKELY(buf != 0)) memset(buf, 0, size);
+	return buf;
+}
+
+/* ws_calloc, or ws_get if keep is set: the buffer then holds what the previous call left in it. */
+static void* ws_keep (s_workspace* ws, int32_t slot, size_t size, int8_t keep) {
+	return keep ? ws_get(ws, slot, size) : ws_calloc(ws, slot, size);
+}
+
+/* Exchange the forward pass buffers of the striped kernels with those of the second read of the dual kernels, see 
+   sw_forward_dual. */
+static void ws_swap_dual (s_workspace* ws) {
+	static const int32_t slot[5] = {WS_H_STORE, WS_H_LOAD, WS_E, WS_H_MAX, WS_MAX_COLUMN};
+	int32_t k;
+	for (k = 0; k < 5; ++k) {
+		void* buf = ws->buf[slot[k]];
+		size_t size = ws->size[slot[k]];
+		ws->buf[slot[k]] = ws->buf[WS_DUAL_H_STORE + k];
+		ws->size[slot[k]] = ws->size[WS_DUAL_H_STORE + k];
+		ws->buf[WS_DUAL_H_STORE + k] = buf;
+		ws->size[WS_DUAL_H_STORE + k] = size;
+	}
+}
+
+/* The 2nd best alignment is the largest column maximum out of the mask [end - maskLen, end + hi] around the best 
+   ending position end (the first such column on a tie). It is found while the columns are scanned, with memory 
+   bounded by maskLen: a column is settled once it is too far from the current one to be masked by a later end, 
+   until then its maximum is kept in a ring. */
+typedef struct {
+	int32_t score;
+	int64_t ref;
+} column_max;
+
+typedef struct {
+	int32_t* ring;	/* maxima of the last len columns */
+	int32_t len, pos, n, lo, hi, step;	/* pos: where the next column goes in ring; n: number of columns in ring */
+	int64_t end, last;	/* best ending position so far; last column pushed */
+	column_max out, in;	/* best settled column out of and in the mask around end */
+} second_best;
+
+static void second_init (second_best* s, s_workspace* ws, int32_t refLen, int32_t maskLen, int32_t hi, int32_t step) {
+	s->len = maskLen + 1 < refLen ? maskLen + 1 : refLen;
+	if (s->len < 1) s->len = 1;
+	s->ring = (int32_t*) ws_get(ws, WS_MAX_COLUMN, s->len * sizeof(int32_t));
+	s->pos = s->n = 0;
+	s->lo = maskLen;
+	s->hi = hi;
+	s->step = step;
+	s->end = s->last = -1;
+	s->out.score = 0;
+	s->out.ref = 0;
+	s->in = s->out;
+}
+
+static inline void second_keep (column_max* b, int32_t score, int64_t ref) {
+	if (score > b->score || (score == b->score && ref < b->ref)) {
+		b->score = score;
+		b->ref = ref;
+	}
+}
+
+static inline void second_settle (second_best* s, int64_t j, int32_t score) {
+	if (j >= s->end - s->lo && j <= s->end + s->hi) second_keep(&s->in, score, j);
+	else second_keep(&s->out, score, j);
+}
+
+/* Add the maximum score of column i; best: i is the new best ending position. */
+static inline void second_push (second_best* s, int64_t i, int32_t score, int8_t best) {
+	if (UNLIKELY(best)) {	/* the columns settled so far are all out of the mask around i */
+		s->end = i;
+		second_keep(&s->out, s->in.score, s->in.ref);
+		s->in.score = s->in.ref = 0;
+	}
+	if (LIKELY(s->n == s->len)) second_settle(s, i - s->step * s->len, s->ring[s->pos]);
+	else ++ s->n;
+	s->ring[s->pos] = score;
+	if (++ s->pos == s->len) s->pos = 0;
+	s->last = i;
+}
+
+/* Settle the columns left in the ring: s->out is then the 2nd best alignment. */
+static void second_flush (second_best* s) {
+	int32_t k, p = s->pos;
+	int64_t j = s->last;
+	for (k = 0; k < s->n; ++k, j -= s->step) {
+		p = p ? p - 1 : s->len - 1;
+		second_settle(s, j, s->ring[p]);
+	}
+	s->n = 0;
+}
+
+static void second_find (second_best* s, alignment_end* b) {
+	second_flush(s);
+	b->score = s->out.score;
+	b->ref = (int32_t)s->out.ref;
+	b->read = 0;
+}
+
+/* State of a striped pass carried from one chunk of the reference to the next, see ssw_stream_feed, or from the 8-bit 
+   kernel to the 16-bit one, see sw_forward. The H and E columns and the column of the best score stay in the workspace. */
+typedef struct {
+	__m128i vMaxScore, vMaxMark;
+	int64_t offset;	/* position of the chunk in the reference */
+	int64_t end_ref;	/* best alignment ending position on the reference; -1: none yet */
+	int32_t max, end_read;
+	int32_t stop;	/* the 8-bit kernels stop once max reaches it, see sw_forward; 0: never */
+	int32_t floor, max_mat;	/* the kernels stop once the score cannot reach floor, see stop_early; 0: never */
+	int32_t xdrop;	/* the kernels stop once a column maximum is more than xdrop below max, see stop_early; 0: never */
+	int32_t next;	/* first column of ref left to the 16-bit kernel when they stopped */
+	second_best second;
+} sw_state;
+
+/* Return 1 if the forward pass can stop after a column with left columns after it, either because no alignment can 
+   reach st->floor any more: the best score so far is below it, and so is the largest score of the column plus max_mat 
+   for each column left, as many as the read has residues (any alignment still to come either goes through the column 
+   or starts after it); or because the largest score of the column is more than st->xdrop below the best score: the 
+   alignments going on through the column have dropped too far to be extended (X-drop). */
+static inline int8_t stop_early (const sw_state* st, int32_t max, int32_t maxColumn, int32_t left, int32_t readLen) {
+	if (st->xdrop > 0 && max - maxColumn > st->xdrop) return 1;
+	return st->floor > 0 && max < st->floor && maxColumn + (int64_t)st->max_mat * (left < readLen ? left : readLen) < st->floor;
+}
+
 /* Generate query profile rearrange query sequence & calculate the weight of match/mismatch. */
 __m128i* qP_byte (const int8_t* read_num,
 				  const int8_t* mat,
 				  const int32_t readLen,
 				  const int32_t n,	/* the edge length of the squre matrix mat */
-				  uint8_t bias) {
+				  uint8_t bias,
+				  void* buf) {	/* where to write the profile; 0: allocate it */
  
 	int32_t segLen = (readLen + 15) / 16; /* Split the 128 bit register into 16 pieces. 
 								     Each piece is 8 bit. Split the read into 16 segments. 
 								     Calculat 16 segments in parallel.
 								   */
-	__m128i* vProfile = (__m128i*)malloc(n * segLen * sizeof(__m128i));
+	__m128i* vProfile = buf ? (__m128i*)buf : (__m128i*)malloc(n * segLen * sizeof(__m128i));
 	int8_t* t = (int8_t*)vProfile;
 	int32_t nt, i, j, segNum;
 	
@@ -132,7 +312,9 @@ alignment_end* sw_sse2_byte (const int8_t* ref,
 												   alignment beginning point. If this score 
 												   is set to 0, it will not be used */
 	 						 uint8_t bias,  /* Shift 0 point to a positive value. */
-							 int32_t maskLen) {  
+							 int32_t maskLen,
+							 s_workspace* ws,
+							 sw_state* st) {	/* 0, or the state of a stream or of sw_forward to resume and save */
       
 #define max16(m, vm) (vm) = _mm_max_epu8((vm), _mm_srli_si128((vm), 8)); \
 					  (vm) = _mm_max_epu8((vm), _mm_srli_si128((vm), 4)); \
@@ -145,19 +327,16 @@ alignment_end* sw_sse2_byte (const int8_t* ref,
 	int32_t end_ref = -1; /* 0_based best alignment ending point; Initialized as isn't aligned -1. */
 	int32_t segLen = (readLen + 15) / 16; /* number of segment */
 	
-	/* array to record the largest score of each reference position */
-	uint8_t* maxColumn = (uint8_t*) calloc(refLen, 1); 
-	
-	/* array to record the alignment read ending position of the largest score of each reference position */
-	int32_t* end_read_column = (int32_t*) calloc(refLen, sizeof(int32_t));
+	uint8_t maxColumn;	/* the largest score of the current column */
+	second_best second;	/* the 2nd best alignment, see second_push */
 	
 	/* Define 16 byte 0 vector. */
 	__m128i vZero = _mm_set1_epi32(0);
 
-	__m128i* pvHStore = (__m128i*) calloc(segLen, sizeof(__m128i));
-	__m128i* pvHLoad = (__m128i*) calloc(segLen, sizeof(__m128i));
-	__m128i* pvE = (__m128i*) calloc(segLen, sizeof(__m128i));
-	__m128i* pvHmax = (__m128i*) calloc(segLen, sizeof(__m128i));
+	__m128i* pvHStore = (__m128i*) ws_keep(ws, WS_H_STORE, segLen * sizeof(__m128i), st != 0);
+	__m128i* pvHLoad = (__m128i*) ws_keep(ws, WS_H_LOAD, segLen * sizeof(__m128i), st != 0);
+	__m128i* pvE = (__m128i*) ws_keep(ws, WS_E, segLen * sizeof(__m128i), st != 0);
+	__m128i* pvHmax = (__m128i*) ws_keep(ws, WS_H_MAX, segLen * sizeof(__m128i), st != 0);
 
 	int32_t i, j;
 	/* 16 byte insertion begin vector */
@@ -172,7 +351,8 @@ alignment_end* sw_sse2_byte (const int8_t* ref,
 	__m128i vMaxScore = vZero; /* Trace the highest score of the whole SW matrix. */
 	__m128i vMaxMark = vZero; /* Trace the highest score till the previous column. */	
 	__m128i vTemp;
-	int32_t edge, begin = 0, end = refLen, step = 1; 
+	int64_t base = st ? st->offset : 0;	/* position of ref in the stream */
+	int32_t begin = 0, end = refLen, step = 1; 
 //	int32_t distance = readLen * 2 / 3;
 //	int32_t distance = readLen / 2;
 //	int32_t distance = readLen;
@@ -183,6 +363,13 @@ alignment_end* sw_sse2_byte (const int8_t* ref,
 		end = -1;
 		step = -1;
 	}
+	if (st) {	/* resume the stream where the previous chunk stopped */
+		vMaxScore = st->vMaxScore;
+		vMaxMark = st->vMaxMark;
+		max = st->max;
+		end_ref = -1;
+		second = st->second;
+	} else second_init(&second, ws, refLen, maskLen, maskLen, step);
 	for (i = begin; LIKELY(i != end); i += step) {
 		int32_t cmp;
 		__m128i e = vZero, vF = vZero, vMaxColumn = vZero; /* Initialize F value to 0. 
@@ -291,9 +478,14 @@ alignment_end* sw_sse2_byte (const int8_t* ref,
 		}
 
 		/* Record the max score of current column. */	
-		max16(maxColumn[i], vMaxColumn);
-//		fprintf(stderr, "maxColumn[%d]: %d\n", i, maxColumn[i]);
-		if (maxColumn[i] == terminate) break;
+		max16(maxColumn, vMaxColumn);
+		second_push(&second, base + i, maxColumn, end_ref == i);
+		if (maxColumn == terminate) break;
+		if (st && UNLIKELY(stop_early(st, max, maxColumn, end - i - 1, readLen))) break;	/* forward only */
+		if (UNLIKELY(st && st->stop && max >= st->stop)) {	/* the next column may overflow */
+			st->next = i + 1;
+			break;
+		}
 	}
 	
 	/* Trace the alignment ending position on read. */
@@ -307,50 +499,193 @@ alignment_end* sw_sse2_byte (const int8_t* ref,
 		}
 	}
 
-	free(pvHmax);
-	free(pvE);
-	free(pvHLoad);
-	free(pvHStore); 	
+
+	if (st) {	/* save the state for the next chunk */
+		if (pvHStore != ws->buf[WS_H_STORE]) memcpy(ws->buf[WS_H_STORE], pvHStore, segLen * sizeof(__m128i));
+		st->vMaxScore = vMaxScore;
+		st->vMaxMark = vMaxMark;
+		st->max = max;
+		st->end_read = end_read;
+		if (end_ref >= 0) st->end_ref = base + end_ref;
+		st->second = second;
+		return 0;
+	}
 
 	/* Find the most possible 2nd best alignment. */
-	alignment_end* bests = (alignment_end*) calloc(2, sizeof(alignment_end));
+	alignment_end* bests = (alignment_end*) ws_calloc(ws, WS_BESTS, 2 * sizeof(alignment_end));
 	bests[0].score = max + bias >= 255 ? 255 : max;
 	bests[0].ref = end_ref;
 	bests[0].read = end_read;
 	
-	bests[1].score = 0;
-	bests[1].ref = 0;
-	bests[1].read = 0;
+	second_find(&second, bests + 1);
+	
+	return bests;
+}
+
+/* Forward pass of two reads of the same length against ref in one scan, e.g. a read and its reverse complement, with 
+   the state of each in st[0] and st[1] (see sw_forward_dual): each column loads ref[i] and finds its row of both 
+   profiles once, and the inner loop steps the two striped columns together. The columns of the first read are in the 
+   buffers of sw_sse2_byte, those of the second in the WS_DUAL ones. The scan ends after the first column where either 
+   read stops; st[s].offset is then the first column read s has left to scan, refLen if it has none. */
+static void sw_sse2_byte_dual (const int8_t* ref,
+							   int32_t refLen,
+							   int32_t readLen, 
+							   const uint8_t weight_gapO, /* will be used as - */
+							   const uint8_t weight_gapE, /* will be used as - */
+							   __m128i** vProfile,	/* the profiles of the 2 reads */
+							   uint8_t bias,
+							   s_workspace* ws,
+							   sw_state* st) {
+
+	int32_t segLen = (readLen + 15) / 16; /* number of segment */
+	__m128i vZero = _mm_set1_epi32(0);
+	__m128i vGapO = _mm_set1_epi8(weight_gapO);
+	__m128i vGapE = _mm_set1_epi8(weight_gapE);
+	__m128i vBias = _mm_set1_epi8(bias);
+	__m128i vTemp, vH[2], vF[2], vMaxColumn[2], vMaxScore[2], vMaxMark[2];
+	__m128i* pvHStore[2] = {(__m128i*)ws->buf[WS_H_STORE], (__m128i*)ws->buf[WS_DUAL_H_STORE]};
+	__m128i* pvHLoad[2] = {(__m128i*)ws->buf[WS_H_LOAD], (__m128i*)ws->buf[WS_DUAL_H_LOAD]};
+	__m128i* pvE[2] = {(__m128i*)ws->buf[WS_E], (__m128i*)ws->buf[WS_DUAL_E]};
+	__m128i* pvHmax[2] = {(__m128i*)ws->buf[WS_H_MAX], (__m128i*)ws->buf[WS_DUAL_H_MAX]};
+	uint8_t max[2], maxColumn;
+	int32_t i, j, s, live[2] = {1, 1};
+
+	for (s = 0; s < 2; ++s) {
+		vMaxScore[s] = st[s].vMaxScore;
+		vMaxMark[s] = st[s].vMaxMark;
+		max[s] = st[s].max;
+	}
+	for (i = 0; LIKELY(i < refLen) && live[0] && live[1]; ++i) {
+		int32_t cmp, row = ref[i] * segLen;
+		__m128i* vP0 = vProfile[0] + row, *vP1 = vProfile[1] + row, *pv, e;
+
+		for (s = 0; s < 2; ++s) {
+			vF[s] = vMaxColumn[s] = vZero;
+			vH[s] = _mm_slli_si128 (pvHStore[s][segLen - 1], 1);
+
+			/* Swap the 2 H buffers. */
+			pv = pvHLoad[s];
+			pvHLoad[s] = pvHStore[s];
+			pvHStore[s] = pv;
+		}
+
+		/* inner loop to process the query sequence, see sw_sse2_byte: the 2 reads are independent */
+		for (j = 0; LIKELY(j < segLen); ++j) {
+			vH[0] = _mm_adds_epu8(vH[0], _mm_load_si128(vP0 + j));
+			vH[1] = _mm_adds_epu8(vH[1], _mm_load_si128(vP1 + j));
+			vH[0] = _mm_subs_epu8(vH[0], vBias);
+			vH[1] = _mm_subs_epu8(vH[1], vBias);
+
+			e = _mm_load_si128(pvE[0] + j);
+			vH[0] = _mm_max_epu8(vH[0], e);
+			vH[0] = _mm_max_epu8(vH[0], vF[0]);
+			vMaxColumn[0] = _mm_max_epu8(vMaxColumn[0], vH[0]);
+			_mm_store_si128(pvHStore[0] + j, vH[0]);
+			vH[0] = _mm_subs_epu8(vH[0], vGapO);
+			e = _mm_subs_epu8(e, vGapE);
+			e = _mm_max_epu8(e, vH[0]);
+			_mm_store_si128(pvE[0] + j, e);
+			vF[0] = _mm_subs_epu8(vF[0], vGapE);
+			vF[0] = _mm_max_epu8(vF[0], vH[0]);
+			vH[0] = _mm_load_si128(pvHLoad[0] + j);
 
-	edge = (end_ref - maskLen) > 0 ? (end_ref - maskLen) : 0;
-	for (i = 0; i < edge; i ++) {
-//			fprintf (stderr, "maxColumn[%d]: %d\n", i, maxColumn[i]); 
-		if (maxColumn[i] > bests[1].score) {
-			bests[1].score = maxColumn[i];
-			bests[1].ref = i;
+			e = _mm_load_si128(pvE[1] + j);
+			vH[1] = _mm_max_epu8(vH[1], e);
+			vH[1] = _mm_max_epu8(vH[1], vF[1]);
+			vMaxColumn[1] = _mm_max_epu8(vMaxColumn[1], vH[1]);
+			_mm_store_si128(pvHStore[1] + j, vH[1]);
+			vH[1] = _mm_subs_epu8(vH[1], vGapO);
+			e = _mm_subs_epu8(e, vGapE);
+			e = _mm_max_epu8(e, vH[1]);
+			_mm_store_si128(pvE[1] + j, e);
+			vF[1] = _mm_subs_epu8(vF[1], vGapE);
+			vF[1] = _mm_max_epu8(vF[1], vH[1]);
+			vH[1] = _mm_load_si128(pvHLoad[1] + j);
+		}
+
+		for (s = 0; s < 2; ++s) {
+			__m128i h, f = _mm_slli_si128 (vF[s], 1);
+			int8_t best = 0;
+
+			/* Lazy_F loop, see sw_sse2_byte */
+			j = 0;
+			h = _mm_load_si128 (pvHStore[s] + j);
+			vTemp = _mm_subs_epu8 (h, vGapO);
+			vTemp = _mm_subs_epu8 (f, vTemp);
+			vTemp = _mm_cmpeq_epi8 (vTemp, vZero);
+			cmp  = _mm_movemask_epi8 (vTemp);
+			while (cmp != 0xffff) {
+				h = _mm_max_epu8 (h, f);
+				vMaxColumn[s] = _mm_max_epu8(vMaxColumn[s], h);
+				_mm_store_si128 (pvHStore[s] + j, h);
+				f = _mm_subs_epu8 (f, vGapE);
+				j++;
+				if (j >= segLen) {
+					j = 0;
+					f = _mm_slli_si128 (f, 1);
+				}
+				h = _mm_load_si128 (pvHStore[s] + j);
+
+				vTemp = _mm_subs_epu8 (h, vGapO);
+				vTemp = _mm_subs_epu8 (f, vTemp);
+				vTemp = _mm_cmpeq_epi8 (vTemp, vZero);
+				cmp  = _mm_movemask_epi8 (vTemp);
+			}
+
+			vMaxScore[s] = _mm_max_epu8(vMaxScore[s], vMaxColumn[s]);
+			vTemp = _mm_cmpeq_epi8(vMaxMark[s], vMaxScore[s]);
+			cmp = _mm_movemask_epi8(vTemp);
+			if (cmp != 0xffff) {
+				uint8_t temp; 
+				vMaxMark[s] = vMaxScore[s];
+				max16(temp, vMaxScore[s]);
+				vMaxScore[s] = vMaxMark[s];
+				
+				if (LIKELY(temp > max[s])) {
+					max[s] = temp;
+					if (max[s] + bias >= 255) {	//overflow
+						live[s] = 0;
+						continue;
+					}
+					st[s].end_ref = i;
+					best = 1;
+					for (j = 0; LIKELY(j < segLen); ++j) pvHmax[s][j] = pvHStore[s][j];
+				}
+			}
+
+			max16(maxColumn, vMaxColumn[s]);
+			second_push(&st[s].second, i, maxColumn, best);
+			if (UNLIKELY(stop_early(&st[s], max[s], maxColumn, refLen - i - 1, readLen))) live[s] = 0;
+			else if (UNLIKELY(st[s].stop && max[s] >= st[s].stop)) {	/* the next column may overflow */
+				st[s].next = i + 1;
+				live[s] = 0;
+			}
 		}
 	}
-	edge = (end_ref + maskLen) > refLen ? refLen : (end_ref + maskLen);
-	for (i = edge + 1; i < refLen; i ++) {
-//			fprintf (stderr, "refLen: %d\tmaxColumn[%d]: %d\n", refLen, i, maxColumn[i]); 
-		if (maxColumn[i] > bests[1].score) {
-			bests[1].score = maxColumn[i];
-			bests[1].ref = i;
+
+	for (s = 0; s < 2; ++s) {	/* save the state of each read, see sw_sse2_byte */
+		uint8_t *t = (uint8_t*)pvHmax[s];
+		int32_t slot = s ? WS_DUAL_H_STORE : WS_H_STORE;
+		st[s].end_read = readLen - 1;
+		for (j = 0; LIKELY(j < segLen * 16); ++j, ++t) {
+			if (*t == max[s] && j / 16 + j % 16 * segLen < st[s].end_read) st[s].end_read = j / 16 + j % 16 * segLen;
 		}
+		if (pvHStore[s] != ws->buf[slot]) memcpy(ws->buf[slot], pvHStore[s], segLen * sizeof(__m128i));
+		st[s].vMaxScore = vMaxScore[s];
+		st[s].vMaxMark = vMaxMark[s];
+		st[s].max = max[s];
+		st[s].offset = live[s] ? i : refLen;
 	}
-	
-	free(maxColumn);
-	free(end_read_column);
-	return bests;
 }
 
 __m128i* qP_word (const int8_t* read_num,
 				  const int8_t* mat,
 				  const int32_t readLen,
-				  const int32_t n) { 
+				  const int32_t n,
+				  void* buf) {	/* where to write the profile; 0: allocate it */
 					
 	int32_t segLen = (readLen + 7) / 8; 
-	__m128i* vProfile = (__m128i*)malloc(n * segLen * sizeof(__m128i));
+	__m128i* vProfile = buf ? (__m128i*)buf : (__m128i*)malloc(n * segLen * sizeof(__m128i));
 	int16_t* t = (int16_t*)vProfile;
 	int32_t nt, i, j;
 	int32_t segNum;
@@ -376,7 +711,9 @@ alignment_end* sw_sse2_word (const int8_t* ref,
 							 const uint8_t weight_gapE, /* will be used as - */
 						     __m128i* vProfile,
 							 uint16_t terminate, 
-							 int32_t maskLen) { 
+							 int32_t maskLen,
+							 s_workspace* ws,
+							 sw_state* st) {	/* 0, or the state of a stream to resume and save */
 
 #define max8(m, vm) (vm) = _mm_max_epi16((vm), _mm_srli_si128((vm), 8)); \
 					(vm) = _mm_max_epi16((vm), _mm_srli_si128((vm), 4)); \
@@ -388,19 +725,16 @@ alignment_end* sw_sse2_word (const int8_t* ref,
 	int32_t end_ref = 0; /* 1_based best alignment ending point; Initialized as isn't aligned - 0. */
 	int32_t segLen = (readLen + 7) / 8; /* number of segment */
 	
-	/* array to record the largest score of each reference position */
-	uint16_t* maxColumn = (uint16_t*) calloc(refLen, 2); 
-	
-	/* array to record the alignment read ending position of the largest score of each reference position */
-	int32_t* end_read_column = (int32_t*) calloc(refLen, sizeof(int32_t));
+	uint16_t maxColumn;	/* the largest score of the current column */
+	second_best second;	/* the 2nd best alignment, see second_push */
 	
 	/* Define 16 byte 0 vector. */
 	__m128i vZero = _mm_set1_epi32(0);
 
-	__m128i* pvHStore = (__m128i*) calloc(segLen, sizeof(__m128i));
-	__m128i* pvHLoad = (__m128i*) calloc(segLen, sizeof(__m128i));
-	__m128i* pvE = (__m128i*) calloc(segLen, sizeof(__m128i));
-	__m128i* pvHmax = (__m128i*) calloc(segLen, sizeof(__m128i));
+	__m128i* pvHStore = (__m128i*) ws_keep(ws, WS_H_STORE, segLen * sizeof(__m128i), st != 0);
+	__m128i* pvHLoad = (__m128i*) ws_keep(ws, WS_H_LOAD, segLen * sizeof(__m128i), st != 0);
+	__m128i* pvE = (__m128i*) ws_keep(ws, WS_E, segLen * sizeof(__m128i), st != 0);
+	__m128i* pvHmax = (__m128i*) ws_keep(ws, WS_H_MAX, segLen * sizeof(__m128i), st != 0);
 
 	int32_t i, j, k;
 	/* 16 byte insertion begin vector */
@@ -413,7 +747,8 @@ alignment_end* sw_sse2_word (const int8_t* ref,
 	__m128i vMaxScore = vZero; /* Trace the highest score of the whole SW matrix. */
 	__m128i vMaxMark = vZero; /* Trace the highest score till the previous column. */	
 	__m128i vTemp;
-	int32_t edge, begin = 0, end = refLen, step = 1;
+	int64_t base = st ? st->offset : 0;	/* position of ref in the stream */
+	int32_t begin = 0, end = refLen, step = 1;
 
 	/* outer loop to process the reference sequence */
 	if (ref_dir == 1) {
@@ -421,6 +756,13 @@ alignment_end* sw_sse2_word (const int8_t* ref,
 		end = -1;
 		step = -1;
 	}
+	if (st) {	/* resume the stream where the previous chunk stopped */
+		vMaxScore = st->vMaxScore;
+		vMaxMark = st->vMaxMark;
+		max = st->max;
+		end_ref = -1;
+		second = st->second;
+	} else second_init(&second, ws, refLen, maskLen, maskLen - 1, step);
 	for (i = begin; LIKELY(i != end); i += step) {
 		int32_t cmp;
 		__m128i e = vZero, vF = vZero; /* Initialize F value to 0. 
@@ -490,14 +832,17 @@ end:
 			
 			if (LIKELY(temp > max)) {
 				max = temp;
+				if (max == 32767) break;	//overflow
 				end_ref = i;
 				for (j = 0; LIKELY(j < segLen); ++j) pvHmax[j] = pvHStore[j];
 			}
 		}
 		
 		/* Record the max score of current column. */	
-		max8(maxColumn[i], vMaxColumn);
-		if (maxColumn[i] == terminate) break;
+		max8(maxColumn, vMaxColumn);
+		second_push(&second, base + i, maxColumn, end_ref == i);
+		if (maxColumn == terminate) break;
+		if (st && UNLIKELY(stop_early(st, max, maxColumn, end - i - 1, readLen))) break;	/* forward only */
 	} 	
 
 	/* Trace the alignment ending position on read. */
@@ -511,305 +856,3003 @@ end:
 		}
 	}
 
-	free(pvHmax);
-	free(pvE);
-	free(pvHLoad);
-	free(pvHStore); 
 	
+	if (st) {	/* save the state for the next chunk */
+		if (pvHStore != ws->buf[WS_H_STORE]) memcpy(ws->buf[WS_H_STORE], pvHStore, segLen * sizeof(__m128i));
+		st->vMaxScore = vMaxScore;
+		st->vMaxMark = vMaxMark;
+		st->max = max;
+		st->end_read = end_read;
+		if (end_ref >= 0) st->end_ref = base + end_ref;
+		st->second = second;
+		return 0;
+	}
+
 	/* Find the most possible 2nd best alignment. */
-	alignment_end* bests = (alignment_end*) calloc(2, sizeof(alignment_end));
+	alignment_end* bests = (alignment_end*) ws_calloc(ws, WS_BESTS, 2 * sizeof(alignment_end));
 	bests[0].score = max;
 	bests[0].ref = end_ref;
 	bests[0].read = end_read;
 	
-	bests[1].score = 0;
-	bests[1].ref = 0;
-	bests[1].read = 0;
-
-	edge = (end_ref - maskLen) > 0 ? (end_ref - maskLen) : 0;
-	for (i = 0; i < edge; i ++) {
-		if (maxColumn[i] > bests[1].score) { 
-			bests[1].score = maxColumn[i];
-			bests[1].ref = i;
-		}
-	}
-	edge = (end_ref + maskLen) > refLen ? refLen : (end_ref + maskLen);
-	for (i = edge; i < refLen; i ++) {
-		if (maxColumn[i] > bests[1].score) {
-			bests[1].score = maxColumn[i];
-			bests[1].ref = i;
-		}
-	}
+	second_find(&second, bests + 1);
 	
-	free(maxColumn);
-	free(end_read_column);
 	return bests;
 }
 
-cigar* banded_sw (const int8_t* ref,
-				 const int8_t* read, 
-				 int32_t refLen, 
-				 int32_t readLen,
-				 int32_t score,
-				 const uint32_t weight_gapO,  /* will be used as - */
-				 const uint32_t weight_gapE,  /* will be used as - */
-				 int32_t band_width,
-				 const int8_t* mat,	/* pointer to the weight matrix */
-				 int32_t n) {	
+__m128i* qP_dword (const int8_t* read_num,
+				   const int8_t* mat,
+				   const int32_t readLen,
+				   const int32_t n,
+				   void* buf) {	/* where to write the profile; 0: allocate it */
 
-	uint32_t *c = (uint32_t*)malloc(16 * sizeof(uint32_t)), *c1;
-	int32_t i, j, e, f, temp1, temp2, s = 16, s1 = 8, s2 = 1024, l, max = 0;
-	int32_t width, width_d, *h_b, *e_b, *h_c;
-	int8_t *direction, *direction_line;
-	cigar* result = (cigar*)malloc(sizeof(cigar));
-	h_b = (int32_t*)malloc(s1 * sizeof(int32_t)); 
-	e_b = (int32_t*)malloc(s1 * sizeof(int32_t)); 
-	h_c = (int32_t*)malloc(s1 * sizeof(int32_t)); 
-	direction = (int8_t*)malloc(s2 * sizeof(int8_t));
-
-	do {
-		width = band_width * 2 + 3, width_d = band_width * 2 + 1;
-		while (width >= s1) {
-			++s1;
-			kroundup32(s1);
-			h_b = (int32_t*)realloc(h_b, s1 * sizeof(int32_t)); 
-			e_b = (int32_t*)realloc(e_b, s1 * sizeof(int32_t)); 
-			h_c = (int32_t*)realloc(h_c, s1 * sizeof(int32_t)); 
-		}
-		while (width_d * readLen * 3 >= s2) {
-			++s2;
-			kroundup32(s2);
-			if (s2 < 0) {
-				fprintf(stderr, "Alignment score and position are not consensus.\n");
-				exit(1);
-			}
-			direction = (int8_t*)realloc(direction, s2 * sizeof(int8_t)); 
-		}
-		direction_line = direction;
-		for (j = 1; LIKELY(j < width - 1); j ++) h_b[j] = 0;
-		for (i = 0; LIKELY(i < readLen); i ++) {
-			int32_t beg = 0, end = refLen - 1, u = 0, edge;
-			j = i - band_width;	beg = beg > j ? beg : j; // band start
-			j = i + band_width; end = end < j ? end : j; // band end
-			edge = end + 1 < width - 1 ? end + 1 : width - 1;
-			f = h_b[0] = e_b[0] = h_b[edge] = e_b[edge] = h_c[0] = 0;
-			direction_line = direction + width_d * i * 3;
-
-			for (j = beg; LIKELY(j <= end); j ++) {
-				int32_t b, e1, f1, d, de, df, dh;
-				set_u(u, band_width, i, j);	set_u(e, band_width, i - 1, j); 
-				set_u(b, band_width, i, j - 1); set_u(d, band_width, i - 1, j - 1);
-				set_d(de, band_width, i, j, 0);
-				set_d(df, band_width, i, j, 1);
-				set_d(dh, band_width, i, j, 2);
-
-				temp1 = i == 0 ? -weight_gapO : h_b[e] - weight_gapO;
-				temp2 = i == 0 ? -weight_gapE : e_b[e] - weight_gapE;
-				e_b[u] = temp1 > temp2 ? temp1 : temp2;
-				direction_line[de] = temp1 > temp2 ? 3 : 2;
-		
-				temp1 = h_c[b] - weight_gapO;
-				temp2 = f - weight_gapE;
-				f = temp1 > temp2 ? temp1 : temp2;
-				direction_line[df] = temp1 > temp2 ? 5 : 4;
-				
-				e1 = e_b[u] > 0 ? e_b[u] : 0;
-				f1 = f > 0 ? f : 0;
-				temp1 = e1 > f1 ? e1 : f1;
-				temp2 = h_b[d] + mat[ref[j] * n + read[i]];
-				h_c[u] = temp1 > temp2 ? temp1 : temp2;
-		
-				if (h_c[u] > max) max = h_c[u];
-		
-				if (temp1 <= temp2) direction_line[dh] = 1;
-				else direction_line[dh] = e1 > f1 ? direction_line[de] : direction_line[df];
-			}
-			for (j = 1; j <= u; j ++) h_b[j] = h_c[j];
-		}
-		band_width *= 2;
-	} while (LIKELY(max < score));
-	band_width /= 2;
+	int32_t segLen = (readLen + 3) / 4;
+	__m128i* vProfile = buf ? (__m128i*)buf : (__m128i*)malloc(n * segLen * sizeof(__m128i));
+	int32_t* t = (int32_t*)vProfile;
+	int32_t nt, i, j;
+	int32_t segNum;
 
-	// trace back
-	i = readLen - 1;
-	j = refLen - 1;
-	e = 0;	// Count the number of M, D or I.
-	l = 0;	// record length of current cigar
-	f = max = 0; // M
-	temp2 = 2;	// h
-	while (LIKELY(i > 0)) {
-		set_d(temp1, band_width, i, j, temp2);
-		switch (direction_line[temp1]) {
-			case 1: 
-				--i;
-				--j;
-				temp2 = 2;
-				direction_line -= width_d * 3;
-				f = 0;	// M
-				break;
-			case 2:
-			 	--i;
-				temp2 = 0;	// e
-				direction_line -= width_d * 3;
-				f = 1;	// I
-				break;		
-			case 3:
-				--i;
-				temp2 = 2;
-				direction_line -= width_d * 3;
-				f = 1;	// I
-				break;
-			case 4:
-				--j;
-				temp2 = 1;
-				f = 2;	// D
-				break;
-			case 5:
-				--j;
-				temp2 = 2;
-				f = 2;	// D
-				break;
-			default: 
-				fprintf(stderr, "Trace back error: %d.\n", direction_line[temp1 - 1]);
-				return 0;
-		}
-		if (f == max) ++e;
-		else {
-			++l;
-			while (l >= s) {
-				++s;
-				kroundup32(s);
-				c = (uint32_t*)realloc(c, s * sizeof(uint32_t));
+	/* Generate query profile rearrange query sequence & calculate the weight of match/mismatch */
+	for (nt = 0; LIKELY(nt < n); nt ++) {
+		for (i = 0; i < segLen; i ++) {
+			j = i;
+			for (segNum = 0; LIKELY(segNum < 4) ; segNum ++) {
+				*t++ = j>= readLen ? 0 : mat[nt * n + read_num[j]];
+				j += segLen;
 			}
-			c[l - 1] = e<<4|max;
-			max = f;
-			e = 1;
-		}
-	}
-	if (f == 0) {
-		++l;
-		while (l >= s) {
-			++s;
-			kroundup32(s);
-			c = (uint32_t*)realloc(c, s * sizeof(uint32_t));
-		}
-		c[l - 1] = (e+1)<<4;
-	}else {
-		l += 2;
-		while (l >= s) {
-			++s;
-			kroundup32(s);
-			c = (uint32_t*)realloc(c, s * sizeof(uint32_t));
 		}
-		c[l - 2] = e<<4|f;
-		c[l - 1] = 16;	// 1M
 	}
+	return vProfile;
+}
 
-	// reverse cigar
-	c1 = (uint32_t*)malloc(l * sizeof(uint32_t));
-	s = 0;
-	e = l - 1;
-	while (LIKELY(s <= e)) {			
-		c1[s] = c[e];		
-		c1[e] = c[s];		
-		++ s;					
-		-- e;						
-	}								
-	result->seq = c1;
-	result->length = l;
+/* SSE2 has no 32-bit max, so it is done with a compare and a blend. */
+#define max_epi32(a, b) _mm_or_si128(_mm_and_si128(_mm_cmpgt_epi32((a), (b)), (a)), _mm_andnot_si128(_mm_cmpgt_epi32((a), (b)), (b)))
 
-	free(direction);
-	free(h_c);
-	free(e_b);
-	free(h_b);
-	free(c);
-	return result;
-}
+/* 32-bit version of sw_sse2_word, used when the alignment score saturates the 16-bit kernel. The scores are not 
+   saturated, so the zero floor that sw_sse2_word gets from _mm_subs_epu16 is applied explicitly. */
+alignment_end* sw_sse2_dword (const int8_t* ref,
+							  int8_t ref_dir,	// 0: forward ref; 1: reverse ref
+							  int32_t refLen,
+							  int32_t readLen,
+							  const uint8_t weight_gapO, /* will be used as - */
+							  const uint8_t weight_gapE, /* will be used as - */
+							  __m128i* vProfile,
+							  int32_t terminate,
+							  int32_t maskLen,
+							  s_workspace* ws,
+							  sw_state* st) {	/* 0, or the state of a stream to resume and save */
 
-int8_t* seq_reverse(const int8_t* seq, int32_t end)	/* end is 0-based alignment ending position */	
-{									
-	int8_t* reverse = (int8_t*)calloc(end + 1, sizeof(int8_t));	
-	int32_t start = 0;
-	while (LIKELY(start <= end)) {			
-		reverse[start] = seq[end];		
-		reverse[end] = seq[start];		
-		++ start;					
-		-- end;						
-	}								
-	return reverse;					
-}
-		
-s_profile* ssw_init (const int8_t* read, const int32_t readLen, const int8_t* mat, const int32_t n, const int8_t score_size) {
-	s_profile* p = (s_profile*)calloc(1, sizeof(struct _profile));
-	p->profile_byte = 0;
-	p->profile_word = 0;
-	p->bias = 0;
-	
-	if (score_size == 0 || score_size == 2) {
-		/* Find the bias to use in the substitution matrix */
-		int32_t bias = 0, i;
-		for (i = 0; i < n*n; i++) if (mat[i] < bias) bias = mat[i];
-		bias = abs(bias);
+#define max4(m, vm) (vm) = max_epi32((vm), _mm_srli_si128((vm), 8)); \
+					(vm) = max_epi32((vm), _mm_srli_si128((vm), 4)); \
+					(m) = _mm_cvtsi128_si32(vm)
 
-		p->bias = bias;
-		p->profile_byte = qP_byte (read, mat, readLen, n, bias);
-	}
-	if (score_size == 1 || score_size == 2) p->profile_word = qP_word (read, mat, readLen, n);
-	p->read = read;
-	p->mat = mat;
-	p->readLen = readLen;
-	p->n = n;
-	return p;
-}
+	int32_t max = 0;		                     /* the max alignment score */
+	int32_t end_read = readLen - 1;
+	int32_t end_ref = 0; /* 1_based best alignment ending point; Initialized as isn't aligned - 0. */
+	int32_t segLen = (readLen + 3) / 4; /* number of segment */
 
-void init_destroy (s_profile* p) {
-	free(p->profile_byte);
-	free(p->profile_word);
-	free(p);
-}
+	int32_t maxColumn;	/* the largest score of the current column */
+	second_best second;	/* the 2nd best alignment, see second_push */
 
-s_align* ssw_align (const s_profile* prof, 
-					const int8_t* ref, 
-				  	int32_t refLen, 
-				  	const uint8_t weight_gapO, 
-				  	const uint8_t weight_gapE, 
-					const uint8_t flag,	//  (from high to low) bit 5: return the best alignment beginning position; 6: if (ref_end1 - ref_begin1 <= filterd) && (read_end1 - read_begin1 <= filterd), return cigar; 7: if max score >= filters, return cigar; 8: always return cigar; if 6 & 7 are both setted, only return cigar when both filter fulfilled
-					const uint16_t filters,
-					const int32_t filterd,
-					const int32_t maskLen) {
+	__m128i vZero = _mm_set1_epi32(0);
 
-	alignment_end* bests = 0, *bests_reverse = 0;
-	__m128i* vP = 0;
-	int32_t word = 0, band_width = 0, readLen = prof->readLen;
-	int8_t* read_reverse = 0;
-	cigar* path;
-	s_align* r = (s_align*)calloc(1, sizeof(s_align));
-	r->ref_begin1 = -1;
-	r->read_begin1 = -1;
-	r->cigar = 0;
-	r->cigarLen = 0;
-	if (maskLen < 15) {
-		fprintf(stderr, "When maskLen < 15, the function ssw_align doesn't return 2nd best alignment information.\n");
-	}
+	__m128i* pvHStore = (__m128i*) ws_keep(ws, WS_H_STORE, segLen * sizeof(__m128i), st != 0);
+	__m128i* pvHLoad = (__m128i*) ws_keep(ws, WS_H_LOAD, segLen * sizeof(__m128i), st != 0);
+	__m128i* pvE = (__m128i*) ws_keep(ws, WS_E, segLen * sizeof(__m128i), st != 0);
+	__m128i* pvHmax = (__m128i*) ws_keep(ws, WS_H_MAX, segLen * sizeof(__m128i), st != 0);
 
-	// Find the alignment scores and ending positions
+	int32_t i, j, k;
+	__m128i vGapO = _mm_set1_epi32(weight_gapO);
+	__m128i vGapE = _mm_set1_epi32(weight_gapE);
+
+	__m128i vMaxScore = vZero; /* Trace the highest score of the whole SW matrix. */
+	__m128i vMaxMark = vZero; /* Trace the highest score till the previous column. */
+	__m128i vTemp;
+	int64_t base = st ? st->offset : 0;	/* position of ref in the stream */
+	int32_t begin = 0, end = refLen, step = 1;
+
+	/* outer loop to process the reference sequence */
+	if (ref_dir == 1) {
+		begin = refLen - 1;
+		end = -1;
+		step = -1;
+	}
+	if (st) {	/* resume the stream where the previous chunk stopped */
+		vMaxScore = st->vMaxScore;
+		vMaxMark = st->vMaxMark;
+		max = st->max;
+		end_ref = -1;
+		second = st->second;
+	} else second_init(&second, ws, refLen, maskLen, maskLen - 1, step);
+	for (i = begin; LIKELY(i != end); i += step) {
+		int32_t cmp;
+		__m128i e, vF = vZero;
+		__m128i vH = pvHStore[segLen - 1];
+		vH = _mm_slli_si128 (vH, 4); /* Shift the 128-bit value in vH left by 4 byte. */
+
+		/* Swap the 2 H buffers. */
+		__m128i* pv = pvHLoad;
+
+		__m128i vMaxColumn = vZero; /* vMaxColumn is used to record the max values of column i. */
+
+		__m128i* vP = vProfile + ref[i] * segLen; /* Right part of the vProfile */
+		pvHLoad = pvHStore;
+		pvHStore = pv;
+
+		/* inner loop to process the query sequence */
+		for (j = 0; LIKELY(j < segLen); j ++) {
+			vH = _mm_add_epi32(vH, _mm_load_si128(vP + j));
+
+			/* Get max from vH, vE and vF. */
+			e = _mm_load_si128(pvE + j);
+			vH = max_epi32(vH, e);
+			vH = max_epi32(vH, vF);
+			vMaxColumn = max_epi32(vMaxColumn, vH);
+
+			/* Save vH values. */
+			_mm_store_si128(pvHStore + j, vH);
+
+			/* Update vE value. */
+			vH = max_epi32(_mm_sub_epi32(vH, vGapO), vZero);
+			e = max_epi32(_mm_sub_epi32(e, vGapE), vZero);
+			e = max_epi32(e, vH);
+			_mm_store_si128(pvE + j, e);
+
+			/* Update vF value. */
+			vF = max_epi32(_mm_sub_epi32(vF, vGapE), vZero);
+			vF = max_epi32(vF, vH);
+
+			/* Load the next vH. */
+			vH = _mm_load_si128(pvHLoad + j);
+		}
+
+		/* Lazy_F loop, see sw_sse2_word */
+		for (k = 0; LIKELY(k < 4); ++k) {
+			vF = _mm_slli_si128 (vF, 4);
+			for (j = 0; LIKELY(j < segLen); ++j) {
+				vH = _mm_load_si128(pvHStore + j);
+				vH = max_epi32(vH, vF);
+				_mm_store_si128(pvHStore + j, vH);
+				vH = max_epi32(_mm_sub_epi32(vH, vGapO), vZero);
+				vF = max_epi32(_mm_sub_epi32(vF, vGapE), vZero);
+				if (UNLIKELY(! _mm_movemask_epi8(_mm_cmpgt_epi32(vF, vH)))) goto end;
+			}
+		}
+
+end:
+		vMaxScore = max_epi32(vMaxScore, vMaxColumn);
+		vTemp = _mm_cmpeq_epi32(vMaxMark, vMaxScore);
+		cmp = _mm_movemask_epi8(vTemp);
+		if (cmp != 0xffff) {
+			int32_t temp;
+			vMaxMark = vMaxScore;
+			max4(temp, vMaxScore);
+			vMaxScore = vMaxMark;
+
+			if (LIKELY(temp > max)) {
+				max = temp;
+				end_ref = i;
+				for (j = 0; LIKELY(j < segLen); ++j) pvHmax[j] = pvHStore[j];
+			}
+		}
+
+		/* Record the max score of current column. */
+		max4(maxColumn, vMaxColumn);
+		second_push(&second, base + i, maxColumn, end_ref == i);
+		if (maxColumn == terminate) break;
+	}
+
+	/* Trace the alignment ending position on read. */
+	int32_t *t = (int32_t*)pvHmax;
+	int32_t column_len = segLen * 4;
+	for (i = 0; LIKELY(i < column_len); ++i, ++t) {
+		int32_t temp;
+		if (*t == max) {
+			temp = i / 4 + i % 4 * segLen;
+			if (temp < end_read) end_read = temp;
+		}
+	}
+
+
+	if (st) {	/* save the state for the next chunk */
+		if (pvHStore != ws->buf[WS_H_STORE]) memcpy(ws->buf[WS_H_STORE], pvHStore, segLen * sizeof(__m128i));
+		st->vMaxScore = vMaxScore;
+		st->vMaxMark = vMaxMark;
+		st->max = max;
+		st->end_read = end_read;
+		if (end_ref >= 0) st->end_ref = base + end_ref;
+		st->second = second;
+		return 0;
+	}
+
+	/* Find the most possible 2nd best alignment. */
+	alignment_end* bests = (alignment_end*) ws_calloc(ws, WS_BESTS, 2 * sizeof(alignment_end));
+	bests[0].score = max;
+	bests[0].ref = end_ref;
+	bests[0].read = end_read;
+
+	second_find(&second, bests + 1);
+
+	return bests;
+}
+
+/* Striped Smith-Waterman that also records where the score of each cell comes from, so that the best alignment can be 
+   traced back from its ending position (see trace_back) instead of being found by a reverse pass and banded_sw. 
+   dir gets 4 masks for each segment j of each column i, dir[(i * segLen + j) * 4 + b], whose bit l is for the read 
+   position l * segLen + j: b = 0 and 1 give the source of H (00: diagonal, 10: E, 01: F, 11: H is 0), b = 2 is set 
+   when E of the next column extends E rather than opening a gap, and b = 3 when F extends the F of the row above. 
+   For the bits to stay consistent, the lazy-F loop also updates E, so unlike sw_sse2_byte the scores are exact. */
+alignment_end* sw_sse2_byte_trace (const int8_t* ref,
+								   int32_t refLen,
+								   int32_t readLen,
+								   const uint8_t weight_gapO, /* will be used as - */
+								   const uint8_t weight_gapE, /* will be used as - */
+								   __m128i* vProfile,
+								   uint8_t bias,
+								   int32_t maskLen,
+								   uint16_t* dir,
+								   s_workspace* ws) {
+
+/* the lanes where a > b, for unsigned bytes */
+#define gt_epu8(a, b) (~_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_subs_epu8((a), (b)), vZero)) & 0xffff)
+
+	uint8_t max = 0;
+	int32_t end_read = readLen - 1;
+	int32_t end_ref = -1;
+	int32_t segLen = (readLen + 15) / 16;
+	uint8_t maxColumn;	/* the largest score of the current column */
+	second_best second;	/* the 2nd best alignment, see second_push */
+	__m128i vZero = _mm_set1_epi32(0);
+
+	__m128i* pvHStore = (__m128i*) ws_calloc(ws, WS_H_STORE, segLen * sizeof(__m128i));
+	__m128i* pvHLoad = (__m128i*) ws_calloc(ws, WS_H_LOAD, segLen * sizeof(__m128i));
+	__m128i* pvE = (__m128i*) ws_calloc(ws, WS_E, segLen * sizeof(__m128i));
+	__m128i* pvF = (__m128i*) ws_calloc(ws, WS_F, segLen * sizeof(__m128i));	/* F of the current column */
+	__m128i* pvHmax = (__m128i*) ws_calloc(ws, WS_H_MAX, segLen * sizeof(__m128i));
+
+	int32_t i, j;
+	__m128i vGapO = _mm_set1_epi8(weight_gapO);
+	__m128i vGapE = _mm_set1_epi8(weight_gapE);
+	__m128i vBias = _mm_set1_epi8(bias);
+	__m128i vMaxScore = vZero, vMaxMark = vZero, vTemp;
+
+	second_init(&second, ws, refLen, maskLen, maskLen, 1);
+	for (i = 0; LIKELY(i < refLen); ++i) {
+		int32_t cmp, fx = 0;	/* fx: the lanes whose F of the next row extends F */
+		__m128i e, vF = vZero, vMaxColumn = vZero;
+		__m128i vH = _mm_slli_si128(pvHStore[segLen - 1], 1);
+		__m128i* vP = vProfile + ref[i] * segLen;
+		uint16_t* d = dir + i * segLen * 4;
+		__m128i* pv = pvHLoad;
+		pvHLoad = pvHStore;
+		pvHStore = pv;
+
+		for (j = 0; LIKELY(j < segLen); ++j) {
+			int32_t zero, diag, gap;
+			__m128i vD = _mm_subs_epu8(_mm_adds_epu8(vH, _mm_load_si128(vP + j)), vBias);
+			e = _mm_load_si128(pvE + j);
+			vH = _mm_max_epu8(_mm_max_epu8(vD, e), vF);
+			vMaxColumn = _mm_max_epu8(vMaxColumn, vH);
+			_mm_store_si128(pvHStore + j, vH);
+			_mm_store_si128(pvF + j, vF);
+
+			/* Where H comes from; the diagonal wins the ties, then E. */
+			zero = _mm_movemask_epi8(_mm_cmpeq_epi8(vH, vZero));
+			diag = _mm_movemask_epi8(_mm_cmpeq_epi8(vH, vD));
+			gap = _mm_movemask_epi8(_mm_cmpeq_epi8(vH, e));
+			d[j * 4] = zero | (~diag & gap);
+			d[j * 4 + 1] = zero | (~(diag | gap) & 0xffff);
+			d[j * 4 + 3] = fx;
+
+			vH = _mm_subs_epu8(vH, vGapO);
+			e = _mm_subs_epu8(e, vGapE);
+			d[j * 4 + 2] = gt_epu8(e, vH);
+			_mm_store_si128(pvE + j, _mm_max_epu8(e, vH));
+
+			vF = _mm_subs_epu8(vF, vGapE);
+			fx = gt_epu8(vF, vH);
+			vF = _mm_max_epu8(vF, vH);
+
+			vH = _mm_load_si128(pvHLoad + j);
+		}
+
+		/* Lazy_F loop: F and the H it raises also update the bits and E. */
+		j = 0;
+		vH = _mm_load_si128(pvHStore);
+		vF = _mm_slli_si128(vF, 1);
+		fx = fx << 1 & 0xffff;
+		vTemp = _mm_subs_epu8(vF, _mm_subs_epu8(vH, vGapO));
+		cmp = _mm_movemask_epi8(_mm_cmpeq_epi8(vTemp, vZero));
+		while (cmp != 0xffff) {
+			uint16_t* dj = d + j * 4;
+			int32_t m;
+			vTemp = _mm_load_si128(pvF + j);
+			m = gt_epu8(vF, vTemp);
+			if (m) {
+				dj[3] = (dj[3] & ~m) | (fx & m);
+				_mm_store_si128(pvF + j, _mm_max_epu8(vF, vTemp));
+			}
+			m = gt_epu8(vF, vH);
+			if (m) {
+				dj[0] &= ~m;
+				dj[1] |= m;
+				vH = _mm_max_epu8(vH, vF);
+				_mm_store_si128(pvHStore + j, vH);
+				vMaxColumn = _mm_max_epu8(vMaxColumn, vH);
+				vTemp = _mm_subs_epu8(vH, vGapO);
+				e = _mm_load_si128(pvE + j);
+				dj[2] &= ~gt_epu8(vTemp, e);
+				_mm_store_si128(pvE + j, _mm_max_epu8(e, vTemp));
+			}
+			vF = _mm_subs_epu8(vF, vGapE);
+			fx = 0xffff;
+			if (++j >= segLen) {
+				j = 0;
+				vF = _mm_slli_si128(vF, 1);
+				fx = 0xfffe;
+			}
+			vH = _mm_load_si128(pvHStore + j);
+			vTemp = _mm_subs_epu8(vF, _mm_subs_epu8(vH, vGapO));
+			cmp = _mm_movemask_epi8(_mm_cmpeq_epi8(vTemp, vZero));
+		}
+
+		vMaxScore = _mm_max_epu8(vMaxScore, vMaxColumn);
+		cmp = _mm_movemask_epi8(_mm_cmpeq_epi8(vMaxMark, vMaxScore));
+		if (cmp != 0xffff) {
+			uint8_t temp;
+			vMaxMark = vMaxScore;
+			max16(temp, vMaxScore);
+			vMaxScore = vMaxMark;
+			if (LIKELY(temp > max)) {
+				max = temp;
+				if (max + bias >= 255) break;	//overflow
+				end_ref = i;
+				for (j = 0; LIKELY(j < segLen); ++j) pvHmax[j] = pvHStore[j];
+			}
+		}
+		max16(maxColumn, vMaxColumn);
+		second_push(&second, i, maxColumn, end_ref == i);
+	}
+
+	/* Trace the alignment ending position on read. */
+	{
+		uint8_t *t = (uint8_t*)pvHmax;
+		for (i = 0; LIKELY(i < segLen * 16); ++i, ++t) {
+			if (*t == max && i / 16 + i % 16 * segLen < end_read) end_read = i / 16 + i % 16 * segLen;
+		}
+	}
+
+
+	/* Find the most possible 2nd best alignment, as sw_sse2_byte does. */
+	alignment_end* bests = (alignment_end*) ws_calloc(ws, WS_BESTS, 2 * sizeof(alignment_end));
+	bests[0].score = max + bias >= 255 ? 255 : max;
+	bests[0].ref = end_ref;
+	bests[0].read = end_read;
+
+	second_find(&second, bests + 1);
+
+	return bests;
+}
+
+/* 16-bit version of sw_sse2_byte_trace. With 8 lanes, the 4 masks of a segment are packed in 2: dir[(i * segLen + j) 
+   * 2] holds the masks 0 and 1 in its low and high bytes, and dir[(i * segLen + j) * 2 + 1] the masks 2 and 3. */
+alignment_end* sw_sse2_word_trace (const int8_t* ref,
+								   int32_t refLen,
+								   int32_t readLen,
+								   const uint8_t weight_gapO, /* will be used as - */
+								   const uint8_t weight_gapE, /* will be used as - */
+								   __m128i* vProfile,
+								   int32_t maskLen,
+								   uint16_t* dir,
+								   s_workspace* ws) {
+
+/* one bit for each of the 8 lanes of a 16-bit mask */
+#define mask8(v) _mm_movemask_epi8(_mm_packs_epi16((v), vZero))
+
+	uint16_t max = 0;
+	int32_t end_read = readLen - 1;
+	int32_t end_ref = -1;
+	int32_t segLen = (readLen + 7) / 8;
+	uint16_t maxColumn;	/* the largest score of the current column */
+	second_best second;	/* the 2nd best alignment, see second_push */
+	__m128i vZero = _mm_set1_epi32(0);
+
+	__m128i* pvHStore = (__m128i*) ws_calloc(ws, WS_H_STORE, segLen * sizeof(__m128i));
+	__m128i* pvHLoad = (__m128i*) ws_calloc(ws, WS_H_LOAD, segLen * sizeof(__m128i));
+	__m128i* pvE = (__m128i*) ws_calloc(ws, WS_E, segLen * sizeof(__m128i));
+	__m128i* pvF = (__m128i*) ws_calloc(ws, WS_F, segLen * sizeof(__m128i));	/* F of the current column */
+	__m128i* pvHmax = (__m128i*) ws_calloc(ws, WS_H_MAX, segLen * sizeof(__m128i));
+
+	int32_t i, j;
+	__m128i vGapO = _mm_set1_epi16(weight_gapO);
+	__m128i vGapE = _mm_set1_epi16(weight_gapE);
+	__m128i vMaxScore = vZero, vMaxMark = vZero, vTemp;
+
+	second_init(&second, ws, refLen, maskLen, maskLen - 1, 1);
+	for (i = 0; LIKELY(i < refLen); ++i) {
+		int32_t cmp, fx = 0;	/* fx: the lanes whose F of the next row extends F */
+		__m128i e, vF = vZero, vMaxColumn = vZero;
+		__m128i vH = _mm_slli_si128(pvHStore[segLen - 1], 2);
+		__m128i* vP = vProfile + ref[i] * segLen;
+		uint16_t* d = dir + i * segLen * 2;
+		__m128i* pv = pvHLoad;
+		pvHLoad = pvHStore;
+		pvHStore = pv;
+
+		for (j = 0; LIKELY(j < segLen); ++j) {
+			int32_t zero, diag, gap;
+			__m128i vD = _mm_adds_epi16(vH, _mm_load_si128(vP + j));
+			e = _mm_load_si128(pvE + j);
+			vH = _mm_max_epi16(_mm_max_epi16(vD, e), vF);
+			vMaxColumn = _mm_max_epi16(vMaxColumn, vH);
+			_mm_store_si128(pvHStore + j, vH);
+			_mm_store_si128(pvF + j, vF);
+
+			zero = mask8(_mm_cmpeq_epi16(vH, vZero));
+			diag = mask8(_mm_cmpeq_epi16(vH, vD));
+			gap = mask8(_mm_cmpeq_epi16(vH, e));
+			d[j * 2] = (zero | (~diag & gap)) | (zero | (~(diag | gap) & 0xff)) << 8;
+
+			vH = _mm_subs_epu16(vH, vGapO);
+			e = _mm_subs_epu16(e, vGapE);
+			d[j * 2 + 1] = mask8(_mm_cmpgt_epi16(e, vH)) | fx << 8;
+			_mm_store_si128(pvE + j, _mm_max_epi16(e, vH));
+
+			vF = _mm_subs_epu16(vF, vGapE);
+			fx = mask8(_mm_cmpgt_epi16(vF, vH));
+			vF = _mm_max_epi16(vF, vH);
+
+			vH = _mm_load_si128(pvHLoad + j);
+		}
+
+		/* Lazy_F loop, see sw_sse2_byte_trace */
+		j = 0;
+		vH = _mm_load_si128(pvHStore);
+		vF = _mm_slli_si128(vF, 2);
+		fx = fx << 1 & 0xff;
+		cmp = mask8(_mm_cmpgt_epi16(vF, _mm_subs_epu16(vH, vGapO)));
+		while (cmp) {
+			uint16_t* dj = d + j * 2;
+			int32_t m;
+			vTemp = _mm_load_si128(pvF + j);
+			m = mask8(_mm_cmpgt_epi16(vF, vTemp));
+			if (m) {
+				dj[1] = (dj[1] & ~(m << 8)) | (fx & m) << 8;
+				_mm_store_si128(pvF + j, _mm_max_epi16(vF, vTemp));
+			}
+			m = mask8(_mm_cmpgt_epi16(vF, vH));
+			if (m) {
+				dj[0] = (dj[0] & ~m) | m << 8;
+				vH = _mm_max_epi16(vH, vF);
+				_mm_store_si128(pvHStore + j, vH);
+				vMaxColumn = _mm_max_epi16(vMaxColumn, vH);
+				vTemp = _mm_subs_epu16(vH, vGapO);
+				e = _mm_load_si128(pvE + j);
+				dj[1] &= ~mask8(_mm_cmpgt_epi16(vTemp, e));
+				_mm_store_si128(pvE + j, _mm_max_epi16(e, vTemp));
+			}
+			vF = _mm_subs_epu16(vF, vGapE);
+			fx = 0xff;
+			if (++j >= segLen) {
+				j = 0;
+				vF = _mm_slli_si128(vF, 2);
+				fx = 0xfe;
+			}
+			vH = _mm_load_si128(pvHStore + j);
+			cmp = mask8(_mm_cmpgt_epi16(vF, _mm_subs_epu16(vH, vGapO)));
+		}
+
+		vMaxScore = _mm_max_epi16(vMaxScore, vMaxColumn);
+		cmp = _mm_movemask_epi8(_mm_cmpeq_epi16(vMaxMark, vMaxScore));
+		if (cmp != 0xffff) {
+			uint16_t temp;
+			vMaxMark = vMaxScore;
+			max8(temp, vMaxScore);
+			vMaxScore = vMaxMark;
+			if (LIKELY(temp > max)) {
+				max = temp;
+				if (max == 32767) break;	//overflow
+				end_ref = i;
+				for (j = 0; LIKELY(j < segLen); ++j) pvHmax[j] = pvHStore[j];
+			}
+		}
+		max8(maxColumn, vMaxColumn);
+		second_push(&second, i, maxColumn, end_ref == i);
+	}
+
+	/* Trace the alignment ending position on read. */
+	{
+		uint16_t *t = (uint16_t*)pvHmax;
+		for (i = 0; LIKELY(i < segLen * 8); ++i, ++t) {
+			if (*t == max && i / 8 + i % 8 * segLen < end_read) end_read = i / 8 + i % 8 * segLen;
+		}
+	}
+
+
+	/* Find the most possible 2nd best alignment, as sw_sse2_word does. */
+	alignment_end* bests = (alignment_end*) ws_calloc(ws, WS_BESTS, 2 * sizeof(alignment_end));
+	bests[0].score = max;
+	bests[0].ref = end_ref;
+	bests[0].read = end_read;
+
+	second_find(&second, bests + 1);
+
+	return bests;
+}
+
+/* Transpose the 16x16 bytes in v, so that v[k] holds byte k of each input vector: each round interleaves the two 
+   halves, and 4 rounds of this perfect shuffle transpose the matrix. */
+static inline void transpose_byte (__m128i* v) {
+	__m128i t[16];
+	int32_t i, r;
+	for (r = 0; r < 4; ++r) {
+		for (i = 0; i < 8; ++i) {
+			t[2 * i] = _mm_unpacklo_epi8(v[i], v[i + 8]);
+			t[2 * i + 1] = _mm_unpackhi_epi8(v[i], v[i + 8]);
+		}
+		for (i = 0; i < 16; ++i) v[i] = t[i];
+	}
+}
+
+/* Transpose the 8x8 words in v, the same way in 3 rounds. */
+static inline void transpose_word (__m128i* v) {
+	__m128i t[8];
+	int32_t i, r;
+	for (r = 0; r < 3; ++r) {
+		for (i = 0; i < 4; ++i) {
+			t[2 * i] = _mm_unpacklo_epi16(v[i], v[i + 4]);
+			t[2 * i + 1] = _mm_unpackhi_epi16(v[i], v[i + 4]);
+		}
+		for (i = 0; i < 8; ++i) v[i] = t[i];
+	}
+}
+
+/* Inter-sequence Smith-Waterman (the SWIPE layout of Rognes, 2011): instead of striping the read over the lanes, 
+   each of the 16 byte lanes holds a different target, so short targets do not leave most of the register idle. Each 
+   pass over the read computes 4 columns of every target, which keeps 4 independent F chains in flight and reads 
+   and writes the H and E arrays once per 4 columns; a target that ends inside the block is padded with scores of 
+   -bias, which cannot raise its best score. When a target ends, the next one in idx is loaded into its lane. There is 
+   no lazy-F loop, F is carried down the column exactly. The best score and ending positions of target idx[k] are 
+   written to ends[idx[k]]. As in sw_sse2_byte, a target whose score reaches 255 - bias is given up with the score 
+   255, so that the caller can redo it with sw_sse2_word_inter. */
+static void sw_sse2_byte_inter (const int8_t** refs,
+								const int32_t* refLens,
+								const int32_t* idx,	/* indices of the targets to align */
+								int32_t num,
+								const int8_t* read,
+								int32_t readLen,
+								const int8_t* mat,
+								int32_t n,
+								const uint8_t weight_gapO, /* will be used as - */
+								const uint8_t weight_gapE, /* will be used as - */
+								uint8_t bias,
+								alignment_end* ends) {
+
+#define inter_byte(vS, vHd, vF, vMax) vH = _mm_subs_epu8(_mm_adds_epu8((vHd), (vS)), vBias); \
+					vH = _mm_max_epu8(vH, e); \
+					vH = _mm_max_epu8(vH, (vF)); \
+					(vMax) = _mm_max_epu8((vMax), vH); \
+					vT = _mm_subs_epu8(vH, vGapO); \
+					e = _mm_max_epu8(_mm_subs_epu8(e, vGapE), vT); \
+					(vF) = _mm_max_epu8(_mm_subs_epu8((vF), vGapE), vT)
+
+	int32_t lane_t[16];	/* the target in each lane; -1: idle */
+	int32_t lane_pos[16], end_ref[16], end_read[16];
+	int32_t next = 0, active = 0, c, i, j, k, l;
+	__m128i vZero = _mm_set1_epi32(0);
+	__m128i vGapO = _mm_set1_epi8(weight_gapO);
+	__m128i vGapE = _mm_set1_epi8(weight_gapE);
+	__m128i vBias = _mm_set1_epi8(bias);
+	__m128i vBest = vZero;	/* the best score of the target in each lane */
+
+	__m128i* pvH = (__m128i*) calloc(readLen * 4, sizeof(__m128i));	/* the 4 columns of the block, row by row */
+	__m128i* pvE = (__m128i*) calloc(readLen, sizeof(__m128i));
+	__m128i* pvS = (__m128i*) calloc(n * 4, sizeof(__m128i));	/* the score of each read residue against each column */
+	int32_t w = (n + 15) / 16;	/* vectors per row of pvM */
+	__m128i* pvM = (__m128i*) calloc((n + 1) * w, sizeof(__m128i));	/* row c: mat[c] + bias; row n: the padding score */
+	uint8_t* best = (uint8_t*)&vBest;
+
+	for (i = 0; i < n; ++i) {
+		for (k = 0; k < n; ++k) ((uint8_t*)(pvM + i * w))[k] = mat[i * n + k] + bias;
+	}
+	for (l = 0; l < 16; ++l) lane_t[l] = -1;
+	for (;;) {
+		__m128i vH, vT, vHold, e;
+		__m128i vHd0 = vZero, vHd1 = vZero, vHd2 = vZero, vHd3 = vZero;	/* the diagonal H of each column */
+		__m128i vF0 = vZero, vF1 = vZero, vF2 = vZero, vF3 = vZero;
+		__m128i vMax0 = vZero, vMax1 = vZero, vMax2 = vZero, vMax3 = vZero;	/* the max of each column */
+		__m128i vMax[4];
+		int32_t cmp;
+
+		/* Load the next targets into the idle lanes; an empty target has no alignment. */
+		for (l = 0; l < 16; ++l) {
+			if (lane_t[l] >= 0) continue;
+			while (next < num && refLens[idx[next]] <= 0) {
+				ends[idx[next]].score = 0;
+				ends[idx[next]].ref = -1;
+				ends[idx[next]].read = readLen - 1;
+				++ next;
+			}
+			if (next == num) continue;
+			lane_t[l] = idx[next ++];
+			lane_pos[l] = 0;
+			end_ref[l] = -1;
+			end_read[l] = readLen - 1;
+			++ active;
+		}
+		if (active == 0) break;
+
+		/* Gather the scores of the 4 columns by transposing the rows of pvM of their residues; past the end of a 
+		   target, and in idle lanes, the score is -bias. */
+		for (c = 0; c < 4; ++c) {
+			const __m128i* row[16];
+			for (l = 0; l < 16; ++l) {
+				int32_t t = lane_t[l];
+				row[l] = pvM + (t < 0 || lane_pos[l] + c >= refLens[t] ? n : refs[t][lane_pos[l] + c]) * w;
+			}
+			for (k = 0; k < w; ++k) {
+				__m128i v[16];
+				for (l = 0; l < 16; ++l) v[l] = _mm_load_si128(row[l] + k);
+				transpose_byte(v);
+				for (l = 0; l < 16 && k * 16 + l < n; ++l) _mm_store_si128(pvS + c * n + k * 16 + l, v[l]);
+			}
+		}
+
+		/* inner loop to process the query sequence */
+		for (j = 0; LIKELY(j < readLen); ++j) {
+			__m128i* pv = pvH + j * 4;
+			__m128i* vP = pvS + read[j];
+			e = _mm_load_si128(pvE + j);
+			vHold = _mm_load_si128(pv + 3);
+			inter_byte(_mm_load_si128(vP), vHd0, vF0, vMax0);
+			_mm_store_si128(pv, vH);
+			vHd0 = vHold;
+			vHold = vH;
+			inter_byte(_mm_load_si128(vP + n), vHd1, vF1, vMax1);
+			_mm_store_si128(pv + 1, vH);
+			vHd1 = vHold;
+			vHold = vH;
+			inter_byte(_mm_load_si128(vP + 2 * n), vHd2, vF2, vMax2);
+			_mm_store_si128(pv + 2, vH);
+			vHd2 = vHold;
+			vHold = vH;
+			inter_byte(_mm_load_si128(vP + 3 * n), vHd3, vF3, vMax3);
+			_mm_store_si128(pv + 3, vH);
+			vHd3 = vHold;
+			_mm_store_si128(pvE + j, e);
+		}
+
+		/* For the lanes whose score improved, the alignment now ends in the first column that reaches the new score, 
+		   on the first row that holds it. */
+		vT = _mm_max_epu8(_mm_max_epu8(vMax0, vMax1), _mm_max_epu8(vMax2, vMax3));
+		vT = _mm_max_epu8(vBest, vT);
+		cmp = ~_mm_movemask_epi8(_mm_cmpeq_epi8(vT, vBest)) & 0xffff;
+		if (cmp) {
+			vBest = vT;
+			vMax[0] = vMax0;
+			vMax[1] = vMax1;
+			vMax[2] = vMax2;
+			vMax[3] = vMax3;
+			for (c = 0; cmp && c < 4; ++c) {
+				int32_t col = _mm_movemask_epi8(_mm_cmpeq_epi8(vMax[c], vBest)) & cmp;
+				cmp &= ~col;
+				for (j = 0; col; ++j) {
+					int32_t hit = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_load_si128(pvH + j * 4 + c), vBest)) & col;
+					for (l = 0; hit >> l; ++l) {
+						if (hit >> l & 1) {
+							end_ref[l] = lane_pos[l] + c;
+							end_read[l] = j;
+						}
+					}
+					col &= ~hit;
+				}
+			}
+		}
+
+		/* Retire the lanes whose target has ended or overflowed, and clear them for the next target. */
+		for (l = 0; l < 16; ++l) {
+			int32_t t = lane_t[l];
+			if (t < 0) continue;
+			lane_pos[l] += 4;
+			if (best[l] + bias >= 255) {
+				ends[t].score = 255;
+				ends[t].ref = end_ref[l];
+				ends[t].read = end_read[l];
+			} else if (lane_pos[l] >= refLens[t]) {
+				ends[t].score = best[l];
+				ends[t].ref = end_ref[l];
+				ends[t].read = end_read[l];
+			} else continue;
+			lane_t[l] = -1;
+			-- active;
+			best[l] = 0;
+			for (i = 0; i < readLen; ++i) ((uint8_t*)(pvH + i * 4 + 3))[l] = ((uint8_t*)(pvE + i))[l] = 0;
+		}
+	}
+
+	free(pvM);
+	free(pvS);
+	free(pvE);
+	free(pvH);
+}
+
+/* 16-bit version of sw_sse2_byte_inter with 8 targets at a time; the scores past the end of a target are 0. A target 
+   whose score reaches 32767 is given up with that score, so that the caller can redo it with the 32-bit kernel. */
+static void sw_sse2_word_inter (const int8_t** refs,
+								const int32_t* refLens,
+								const int32_t* idx,	/* indices of the targets to align */
+								int32_t num,
+								const int8_t* read,
+								int32_t readLen,
+								const int8_t* mat,
+								int32_t n,
+								const uint8_t weight_gapO, /* will be used as - */
+								const uint8_t weight_gapE, /* will be used as - */
+								alignment_end* ends) {
+
+#define inter_word(vS, vHd, vF, vMax) vH = _mm_adds_epi16((vHd), (vS)); \
+					vH = _mm_max_epi16(vH, e); \
+					vH = _mm_max_epi16(vH, (vF)); \
+					(vMax) = _mm_max_epi16((vMax), vH); \
+					vT = _mm_subs_epu16(vH, vGapO); \
+					e = _mm_max_epi16(_mm_subs_epu16(e, vGapE), vT); \
+					(vF) = _mm_max_epi16(_mm_subs_epu16((vF), vGapE), vT)
+
+	int32_t lane_t[8];	/* the target in each lane; -1: idle */
+	int32_t lane_pos[8], end_ref[8], end_read[8];
+	int32_t next = 0, active = 0, c, i, j, k, l;
+	__m128i vZero = _mm_set1_epi32(0);
+	__m128i vGapO = _mm_set1_epi16(weight_gapO);
+	__m128i vGapE = _mm_set1_epi16(weight_gapE);
+	__m128i vBest = vZero;	/* the best score of the target in each lane */
+
+	__m128i* pvH = (__m128i*) calloc(readLen * 4, sizeof(__m128i));	/* the 4 columns of the block, row by row */
+	__m128i* pvE = (__m128i*) calloc(readLen, sizeof(__m128i));
+	__m128i* pvS = (__m128i*) calloc(n * 4, sizeof(__m128i));	/* the score of each read residue against each column */
+	int32_t w = (n + 7) / 8;	/* vectors per row of pvM */
+	__m128i* pvM = (__m128i*) calloc((n + 1) * w, sizeof(__m128i));	/* row c: mat[c]; row n: the padding score */
+	int16_t* best = (int16_t*)&vBest;
+
+	for (i = 0; i < n; ++i) {
+		for (k = 0; k < n; ++k) ((int16_t*)(pvM + i * w))[k] = mat[i * n + k];
+	}
+	for (l = 0; l < 8; ++l) lane_t[l] = -1;
+	for (;;) {
+		__m128i vH, vT, vHold, e;
+		__m128i vHd0 = vZero, vHd1 = vZero, vHd2 = vZero, vHd3 = vZero;	/* the diagonal H of each column */
+		__m128i vF0 = vZero, vF1 = vZero, vF2 = vZero, vF3 = vZero;
+		__m128i vMax0 = vZero, vMax1 = vZero, vMax2 = vZero, vMax3 = vZero;	/* the max of each column */
+		__m128i vMax[4];
+		int32_t cmp;
+
+		/* Load the next targets into the idle lanes; an empty target has no alignment. */
+		for (l = 0; l < 8; ++l) {
+			if (lane_t[l] >= 0) continue;
+			while (next < num && refLens[idx[next]] <= 0) {
+				ends[idx[next]].score = 0;
+				ends[idx[next]].ref = -1;
+				ends[idx[next]].read = readLen - 1;
+				++ next;
+			}
+			if (next == num) continue;
+			lane_t[l] = idx[next ++];
+			lane_pos[l] = 0;
+			end_ref[l] = -1;
+			end_read[l] = readLen - 1;
+			++ active;
+		}
+		if (active == 0) break;
+
+		/* Gather the scores of the 4 columns. */
+		for (c = 0; c < 4; ++c) {
+			const __m128i* row[8];
+			for (l = 0; l < 8; ++l) {
+				int32_t t = lane_t[l];
+				row[l] = pvM + (t < 0 || lane_pos[l] + c >= refLens[t] ? n : refs[t][lane_pos[l] + c]) * w;
+			}
+			for (k = 0; k < w; ++k) {
+				__m128i v[8];
+				for (l = 0; l < 8; ++l) v[l] = _mm_load_si128(row[l] + k);
+				transpose_word(v);
+				for (l = 0; l < 8 && k * 8 + l < n; ++l) _mm_store_si128(pvS + c * n + k * 8 + l, v[l]);
+			}
+		}
+
+		/* inner loop to process the query sequence */
+		for (j = 0; LIKELY(j < readLen); ++j) {
+			__m128i* pv = pvH + j * 4;
+			__m128i* vP = pvS + read[j];
+			e = _mm_load_si128(pvE + j);
+			vHold = _mm_load_si128(pv + 3);
+			inter_word(_mm_load_si128(vP), vHd0, vF0, vMax0);
+			_mm_store_si128(pv, vH);
+			vHd0 = vHold;
+			vHold = vH;
+			inter_word(_mm_load_si128(vP + n), vHd1, vF1, vMax1);
+			_mm_store_si128(pv + 1, vH);
+			vHd1 = vHold;
+			vHold = vH;
+			inter_word(_mm_load_si128(vP + 2 * n), vHd2, vF2, vMax2);
+			_mm_store_si128(pv + 2, vH);
+			vHd2 = vHold;
+			vHold = vH;
+			inter_word(_mm_load_si128(vP + 3 * n), vHd3, vF3, vMax3);
+			_mm_store_si128(pv + 3, vH);
+			vHd3 = vHold;
+			_mm_store_si128(pvE + j, e);
+		}
+
+		/* See sw_sse2_byte_inter; the masks have 2 bits per lane. */
+		vT = _mm_max_epi16(_mm_max_epi16(vMax0, vMax1), _mm_max_epi16(vMax2, vMax3));
+		cmp = _mm_movemask_epi8(_mm_cmpgt_epi16(vT, vBest));
+		if (cmp) {
+			vBest = _mm_max_epi16(vBest, vT);
+			vMax[0] = vMax0;
+			vMax[1] = vMax1;
+			vMax[2] = vMax2;
+			vMax[3] = vMax3;
+			for (c = 0; cmp && c < 4; ++c) {
+				int32_t col = _mm_movemask_epi8(_mm_cmpeq_epi16(vMax[c], vBest)) & cmp;
+				cmp &= ~col;
+				for (j = 0; col; ++j) {
+					int32_t hit = _mm_movemask_epi8(_mm_cmpeq_epi16(_mm_load_si128(pvH + j * 4 + c), vBest)) & col;
+					for (l = 0; hit >> (l * 2); ++l) {
+						if (hit >> (l * 2) & 1) {
+							end_ref[l] = lane_pos[l] + c;
+							end_read[l] = j;
+						}
+					}
+					col &= ~hit;
+				}
+			}
+		}
+
+		/* Retire the lanes whose target has ended or overflowed, and clear them for the next target. */
+		for (l = 0; l < 8; ++l) {
+			int32_t t = lane_t[l];
+			if (t < 0) continue;
+			lane_pos[l] += 4;
+			if (best[l] == 32767) {
+				ends[t].score = 32767;
+				ends[t].ref = end_ref[l];
+				ends[t].read = end_read[l];
+			} else if (lane_pos[l] >= refLens[t]) {
+				ends[t].score = best[l];
+				ends[t].ref = end_ref[l];
+				ends[t].read = end_read[l];
+			} else continue;
+			lane_t[l] = -1;
+			-- active;
+			best[l] = 0;
+			for (i = 0; i < readLen; ++i) ((int16_t*)(pvH + i * 4 + 3))[l] = ((int16_t*)(pvE + i))[l] = 0;
+		}
+	}
+
+	free(pvM);
+	free(pvS);
+	free(pvE);
+	free(pvH);
+}
+
+/* Generate the query profile of up to 16 reads, one read per byte lane: vector c * rows + j holds the score of 
+   residue c against residue j of each read. Like the striped profile, each read is padded with scores of 0 to a 
+   multiple of 16 residues; the rows below that, and the extra residue n used past the end of the reference, score 
+   -bias. */
+__m128i* qP_byte_multi (const int8_t** reads,
+						const int32_t* readLens,
+						int32_t num,	/* number of reads, <= 16 */
+						const int8_t* mat,
+						const int32_t n,
+						uint8_t bias,
+						int32_t rows) {
+
+	__m128i* vProfile = (__m128i*)calloc((n + 1) * rows, sizeof(__m128i));
+	uint8_t* t = (uint8_t*)vProfile;
+	int32_t nt, j, l;
+
+	for (nt = 0; LIKELY(nt < n); nt ++) {
+		for (j = 0; j < rows; j ++) {
+			for (l = 0; l < num; l ++) {
+				if (j < readLens[l]) t[l] = mat[nt * n + reads[l][j]] + bias;
+				else if (j < (readLens[l] + 15) / 16 * 16) t[l] = bias;
+			}
+			t += 16;
+		}
+	}
+	return vProfile;
+}
+
+/* Multi-query Smith-Waterman: the reads of vProfile, one per byte lane, are aligned against the same reference in one 
+   pass, the same way as sw_sse2_byte_inter does with its targets. Lane l only starts at column start[l] (all lanes 
+   start at 0 if start is 0), which lets the reverse pass of all lanes share one reversed reference; it is done once 
+   each lane has reached terminate[l]. Return the best and 2nd best alignment of lane l in bests[2 * l] and 
+   bests[2 * l + 1], as sw_sse2_byte does; the score of an overflowed lane is 255. */
+alignment_end* sw_sse2_byte_multi (const int8_t* ref,
+								   int32_t refLen,
+								   const int32_t* readLens,
+								   int32_t num,	/* number of reads, <= 16 */
+								   int32_t rows,
+								   const uint8_t weight_gapO, /* will be used as - */
+								   const uint8_t weight_gapE, /* will be used as - */
+								   const __m128i* vProfile,
+								   int32_t n,
+								   const int32_t* start,
+								   const int32_t* terminate,
+								   uint8_t bias,
+								   int32_t maskLen) {
+
+#define multi_byte(vS, vHd, vF, vMax) vH = _mm_subs_epu8(_mm_adds_epu8((vHd), (vS)), vBias); \
+					vH = _mm_max_epu8(vH, e); \
+					vH = _mm_max_epu8(vH, (vF)); \
+					(vMax) = _mm_max_epu8((vMax), vH); \
+					vT = _mm_subs_epu8(vH, vGapO); \
+					e = _mm_max_epu8(_mm_subs_epu8(e, vGapE), vT); \
+					(vF) = _mm_max_epu8(_mm_subs_epu8((vF), vGapE), vT)
+
+	int32_t end_ref[16], end_read[16];
+	int32_t i, j, c, l, edge;
+	__m128i vZero = _mm_set1_epi32(0);
+	__m128i vGapO = _mm_set1_epi8(weight_gapO);
+	__m128i vGapE = _mm_set1_epi8(weight_gapE);
+	__m128i vBias = _mm_set1_epi8(bias);
+	__m128i vBest = vZero;	/* the best score of each lane */
+	uint8_t live[4][16];	/* 0xff in the lanes that have started, for each column of the block */
+
+	__m128i* pvH = (__m128i*) calloc(rows * 4, sizeof(__m128i));	/* the 4 columns of the block, row by row */
+	__m128i* pvE = (__m128i*) calloc(rows, sizeof(__m128i));
+	__m128i* pvMaxColumn = (__m128i*) calloc(refLen + 3, sizeof(__m128i));	/* the largest score of each reference position */
+	uint8_t* best = (uint8_t*)&vBest;
+	uint8_t* maxColumn = (uint8_t*)pvMaxColumn;
+	alignment_end* bests = (alignment_end*) calloc(2 * num, sizeof(alignment_end));
+
+	for (l = 0; l < 16; ++l) {
+		end_ref[l] = -1;
+		end_read[l] = l < num ? readLens[l] - 1 : 0;
+	}
+	memset(live, 0xff, sizeof(live));
+
+	/* outer loop to process the reference sequence, 4 columns at a time */
+	for (i = 0; LIKELY(i < refLen); i += 4) {
+		__m128i vH, vT, vHold, e;
+		__m128i vHd0 = vZero, vHd1 = vZero, vHd2 = vZero, vHd3 = vZero;	/* the diagonal H of each column */
+		__m128i vF0 = vZero, vF1 = vZero, vF2 = vZero, vF3 = vZero;
+		__m128i vMax0 = vZero, vMax1 = vZero, vMax2 = vZero, vMax3 = vZero;	/* the max of each column */
+		__m128i vL0, vL1, vL2, vL3;
+		const __m128i* vP0 = vProfile + ref[i] * rows;
+		const __m128i* vP1 = vProfile + (i + 1 < refLen ? ref[i + 1] : n) * rows;
+		const __m128i* vP2 = vProfile + (i + 2 < refLen ? ref[i + 2] : n) * rows;
+		const __m128i* vP3 = vProfile + (i + 3 < refLen ? ref[i + 3] : n) * rows;
+		int32_t cmp;
+
+		/* A lane that has not started scores -bias, which keeps its H and E at 0. */
+		if (start) {
+			for (c = 0; c < 4; ++c) {
+				for (l = 0; l < 16; ++l) live[c][l] = l < num && i + c >= start[l] ? 0xff : 0;
+			}
+		}
+		vL0 = _mm_loadu_si128((__m128i*)live[0]);
+		vL1 = _mm_loadu_si128((__m128i*)live[1]);
+		vL2 = _mm_loadu_si128((__m128i*)live[2]);
+		vL3 = _mm_loadu_si128((__m128i*)live[3]);
+
+		/* inner loop to process the query sequence */
+		for (j = 0; LIKELY(j < rows); ++j) {
+			__m128i* pv = pvH + j * 4;
+			e = _mm_load_si128(pvE + j);
+			vHold = _mm_load_si128(pv + 3);
+			multi_byte(_mm_and_si128(_mm_load_si128(vP0 + j), vL0), vHd0, vF0, vMax0);
+			_mm_store_si128(pv, vH);
+			vHd0 = vHold;
+			vHold = vH;
+			multi_byte(_mm_and_si128(_mm_load_si128(vP1 + j), vL1), vHd1, vF1, vMax1);
+			_mm_store_si128(pv + 1, vH);
+			vHd1 = vHold;
+			vHold = vH;
+			multi_byte(_mm_and_si128(_mm_load_si128(vP2 + j), vL2), vHd2, vF2, vMax2);
+			_mm_store_si128(pv + 2, vH);
+			vHd2 = vHold;
+			vHold = vH;
+			multi_byte(_mm_and_si128(_mm_load_si128(vP3 + j), vL3), vHd3, vF3, vMax3);
+			_mm_store_si128(pv + 3, vH);
+			vHd3 = vHold;
+			_mm_store_si128(pvE + j, e);
+		}
+
+		/* Record the max score of each column; the ones past the end of the reference are not used. */
+		_mm_store_si128(pvMaxColumn + i, vMax0);
+		_mm_store_si128(pvMaxColumn + i + 1, vMax1);
+		_mm_store_si128(pvMaxColumn + i + 2, vMax2);
+		_mm_store_si128(pvMaxColumn + i + 3, vMax3);
+
+		/* For the lanes whose score improved, see sw_sse2_byte_inter. */
+		vT = _mm_max_epu8(_mm_max_epu8(vMax0, vMax1), _mm_max_epu8(vMax2, vMax3));
+		vT = _mm_max_epu8(vBest, vT);
+		cmp = ~_mm_movemask_epi8(_mm_cmpeq_epi8(vT, vBest)) & 0xffff;
+		if (cmp) {
+			vBest = vT;
+			for (c = 0; cmp && c < 4; ++c) {
+				int32_t col = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_load_si128(pvMaxColumn + i + c), vBest)) & cmp;
+				cmp &= ~col;
+				for (j = 0; col; ++j) {
+					int32_t hit = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_load_si128(pvH + j * 4 + c), vBest)) & col;
+					for (l = 0; hit >> l; ++l) {
+						if (hit >> l & 1) {
+							end_ref[l] = i + c;
+							end_read[l] = j;
+						}
+					}
+					col &= ~hit;
+				}
+			}
+		}
+
+		if (terminate) {
+			for (l = 0; l < num && best[l] >= terminate[l]; ++l);
+			if (l == num) break;
+		}
+	}
+
+	/* Find the most possible 2nd best alignment of each lane. */
+	for (l = 0; l < num; ++l) {
+		alignment_end* b = bests + 2 * l;
+		b[0].score = best[l] + bias >= 255 ? 255 : best[l];
+		b[0].ref = end_ref[l];
+		b[0].read = end_read[l];
+
+		edge = (end_ref[l] - maskLen) > 0 ? (end_ref[l] - maskLen) : 0;
+		for (i = 0; i < edge; i ++) {
+			if (maxColumn[i * 16 + l] > b[1].score) {
+				b[1].score = maxColumn[i * 16 + l];
+				b[1].ref = i;
+			}
+		}
+		edge = (end_ref[l] + maskLen) > refLen ? refLen : (end_ref[l] + maskLen);
+		for (i = edge + 1; i < refLen; i ++) {
+			if (maxColumn[i * 16 + l] > b[1].score) {
+				b[1].score = maxColumn[i * 16 + l];
+				b[1].ref = i;
+			}
+		}
+	}
+
+	free(pvMaxColumn);
+	free(pvE);
+	free(pvH);
+	return bests;
+}
+
+/* 16-bit version of qP_byte_multi for up to 8 reads; the padding to a multiple of 8 residues scores 0, and the rows 
+   below it as well as the residue n score -32768. */
+__m128i* qP_word_multi (const int8_t** reads,
+						const int32_t* readLens,
+						int32_t num,	/* number of reads, <= 8 */
+						const int8_t* mat,
+						const int32_t n,
+						int32_t rows) {
+
+	__m128i* vProfile = (__m128i*)malloc((n + 1) * rows * sizeof(__m128i));
+	int16_t* t = (int16_t*)vProfile;
+	int32_t nt, j, l;
+
+	for (nt = 0; LIKELY(nt <= n); nt ++) {
+		for (j = 0; j < rows; j ++) {
+			for (l = 0; l < 8; l ++) {
+				if (nt == n || l >= num || j >= (readLens[l] + 7) / 8 * 8) t[l] = -32768;
+				else t[l] = j < readLens[l] ? mat[nt * n + reads[l][j]] : 0;
+			}
+			t += 8;
+		}
+	}
+	return vProfile;
+}
+
+/* 16-bit version of sw_sse2_byte_multi with 8 lanes; the score of an overflowed lane is 32767. A lane that has not 
+   started scores 0, which keeps its H and E at 0 as well. */
+alignment_end* sw_sse2_word_multi (const int8_t* ref,
+								   int32_t refLen,
+								   const int32_t* readLens,
+								   int32_t num,	/* number of reads, <= 8 */
+								   int32_t rows,
+								   const uint8_t weight_gapO, /* will be used as - */
+								   const uint8_t weight_gapE, /* will be used as - */
+								   const __m128i* vProfile,
+								   int32_t n,
+								   const int32_t* start,
+								   const int32_t* terminate,
+								   int32_t maskLen) {
+
+#define multi_word(vS, vHd, vF, vMax) vH = _mm_adds_epi16((vHd), (vS)); \
+					vH = _mm_max_epi16(vH, e); \
+					vH = _mm_max_epi16(vH, (vF)); \
+					(vMax) = _mm_max_epi16((vMax), vH); \
+					vT = _mm_subs_epu16(vH, vGapO); \
+					e = _mm_max_epi16(_mm_subs_epu16(e, vGapE), vT); \
+					(vF) = _mm_max_epi16(_mm_subs_epu16((vF), vGapE), vT)
+
+	int32_t end_ref[8], end_read[8];
+	int32_t i, j, c, l, edge;
+	__m128i vZero = _mm_set1_epi32(0);
+	__m128i vGapO = _mm_set1_epi16(weight_gapO);
+	__m128i vGapE = _mm_set1_epi16(weight_gapE);
+	__m128i vBest = vZero;	/* the best score of each lane */
+	int16_t live[4][8];	/* -1 in the lanes that have started, for each column of the block */
+
+	__m128i* pvH = (__m128i*) calloc(rows * 4, sizeof(__m128i));	/* the 4 columns of the block, row by row */
+	__m128i* pvE = (__m128i*) calloc(rows, sizeof(__m128i));
+	__m128i* pvMaxColumn = (__m128i*) calloc(refLen + 3, sizeof(__m128i));	/* the largest score of each reference position */
+	int16_t* best = (int16_t*)&vBest;
+	int16_t* maxColumn = (int16_t*)pvMaxColumn;
+	alignment_end* bests = (alignment_end*) calloc(2 * num, sizeof(alignment_end));
+
+	for (l = 0; l < 8; ++l) {
+		end_ref[l] = -1;
+		end_read[l] = l < num ? readLens[l] - 1 : 0;
+	}
+	memset(live, 0xff, sizeof(live));
+
+	/* outer loop to process the reference sequence, 4 columns at a time */
+	for (i = 0; LIKELY(i < refLen); i += 4) {
+		__m128i vH, vT, vHold, e;
+		__m128i vHd0 = vZero, vHd1 = vZero, vHd2 = vZero, vHd3 = vZero;	/* the diagonal H of each column */
+		__m128i vF0 = vZero, vF1 = vZero, vF2 = vZero, vF3 = vZero;
+		__m128i vMax0 = vZero, vMax1 = vZero, vMax2 = vZero, vMax3 = vZero;	/* the max of each column */
+		__m128i vL0, vL1, vL2, vL3;
+		const __m128i* vP0 = vProfile + ref[i] * rows;
+		const __m128i* vP1 = vProfile + (i + 1 < refLen ? ref[i + 1] : n) * rows;
+		const __m128i* vP2 = vProfile + (i + 2 < refLen ? ref[i + 2] : n) * rows;
+		const __m128i* vP3 = vProfile + (i + 3 < refLen ? ref[i + 3] : n) * rows;
+		int32_t cmp;
+
+		if (start) {
+			for (c = 0; c < 4; ++c) {
+				for (l = 0; l < 8; ++l) live[c][l] = l < num && i + c >= start[l] ? -1 : 0;
+			}
+		}
+		vL0 = _mm_loadu_si128((__m128i*)live[0]);
+		vL1 = _mm_loadu_si128((__m128i*)live[1]);
+		vL2 = _mm_loadu_si128((__m128i*)live[2]);
+		vL3 = _mm_loadu_si128((__m128i*)live[3]);
+
+		/* inner loop to process the query sequence */
+		for (j = 0; LIKELY(j < rows); ++j) {
+			__m128i* pv = pvH + j * 4;
+			e = _mm_load_si128(pvE + j);
+			vHold = _mm_load_si128(pv + 3);
+			multi_word(_mm_and_si128(_mm_load_si128(vP0 + j), vL0), vHd0, vF0, vMax0);
+			_mm_store_si128(pv, vH);
+			vHd0 = vHold;
+			vHold = vH;
+			multi_word(_mm_and_si128(_mm_load_si128(vP1 + j), vL1), vHd1, vF1, vMax1);
+			_mm_store_si128(pv + 1, vH);
+			vHd1 = vHold;
+			vHold = vH;
+			multi_word(_mm_and_si128(_mm_load_si128(vP2 + j), vL2), vHd2, vF2, vMax2);
+			_mm_store_si128(pv + 2, vH);
+			vHd2 = vHold;
+			vHold = vH;
+			multi_word(_mm_and_si128(_mm_load_si128(vP3 + j), vL3), vHd3, vF3, vMax3);
+			_mm_store_si128(pv + 3, vH);
+			vHd3 = vHold;
+			_mm_store_si128(pvE + j, e);
+		}
+
+		_mm_store_si128(pvMaxColumn + i, vMax0);
+		_mm_store_si128(pvMaxColumn + i + 1, vMax1);
+		_mm_store_si128(pvMaxColumn + i + 2, vMax2);
+		_mm_store_si128(pvMaxColumn + i + 3, vMax3);
+
+		/* For the lanes whose score improved, see sw_sse2_byte_inter; the masks have 2 bits per lane. */
+		vT = _mm_max_epi16(_mm_max_epi16(vMax0, vMax1), _mm_max_epi16(vMax2, vMax3));
+		cmp = _mm_movemask_epi8(_mm_cmpgt_epi16(vT, vBest));
+		if (cmp) {
+			vBest = _mm_max_epi16(vBest, vT);
+			for (c = 0; cmp && c < 4; ++c) {
+				int32_t col = _mm_movemask_epi8(_mm_cmpeq_epi16(_mm_load_si128(pvMaxColumn + i + c), vBest)) & cmp;
+				cmp &= ~col;
+				for (j = 0; col; ++j) {
+					int32_t hit = _mm_movemask_epi8(_mm_cmpeq_epi16(_mm_load_si128(pvH + j * 4 + c), vBest)) & col;
+					for (l = 0; hit >> (l * 2); ++l) {
+						if (hit >> (l * 2) & 1) {
+							end_ref[l] = i + c;
+							end_read[l] = j;
+						}
+					}
+					col &= ~hit;
+				}
+			}
+		}
+
+		if (terminate) {
+			for (l = 0; l < num && best[l] >= terminate[l]; ++l);
+			if (l == num) break;
+		}
+	}
+
+	/* Find the most possible 2nd best alignment of each lane. */
+	for (l = 0; l < num; ++l) {
+		alignment_end* b = bests + 2 * l;
+		b[0].score = best[l];
+		b[0].ref = end_ref[l];
+		b[0].read = end_read[l];
+
+		edge = (end_ref[l] - maskLen) > 0 ? (end_ref[l] - maskLen) : 0;
+		for (i = 0; i < edge; i ++) {
+			if (maxColumn[i * 8 + l] > b[1].score) {
+				b[1].score = maxColumn[i * 8 + l];
+				b[1].ref = i;
+			}
+		}
+		edge = (end_ref[l] + maskLen) > refLen ? refLen : (end_ref[l] + maskLen);
+		for (i = edge; i < refLen; i ++) {
+			if (maxColumn[i * 8 + l] > b[1].score) {
+				b[1].score = maxColumn[i * 8 + l];
+				b[1].ref = i;
+			}
+		}
+	}
+
+	free(pvMaxColumn);
+	free(pvE);
+	free(pvH);
+	return bests;
+}
+
+#ifdef SSW_AVX2
+
+/* Shift the 256-bit value in v left by one byte (vH) or one word (vW), across the two 128-bit lanes. */
+#define slli_byte_avx2(v) _mm256_alignr_epi8((v), _mm256_permute2x128_si256((v), (v), 0x08), 15)
+#define slli_word_avx2(v) _mm256_alignr_epi8((v), _mm256_permute2x128_si256((v), (v), 0x08), 14)
+
+/* Generate the 256-bit query profile: the same layout as qP_byte, but the read is split into 32 segments. */
+__m256i* qP_byte_avx2 (const int8_t* read_num,
+					   const int8_t* mat,
+					   const int32_t readLen,
+					   const int32_t n,	/* the edge length of the squre matrix mat */
+					   uint8_t bias,
+					   void* buf) {	/* where to write the profile; 0: allocate it */
+
+	int32_t segLen = (readLen + 31) / 32; /* Split the 256 bit register into 32 pieces. */
+	__m256i* vProfile = buf ? (__m256i*)buf : (__m256i*)_mm_malloc(n * segLen * sizeof(__m256i), 32);
+	int8_t* t = (int8_t*)vProfile;
+	int32_t nt, i, j, segNum;
+
+	for (nt = 0; LIKELY(nt < n); nt ++) {
+		for (i = 0; i < segLen; i ++) {
+			j = i;
+			for (segNum = 0; LIKELY(segNum < 32) ; segNum ++) {
+				*t++ = j>= readLen ? bias : mat[nt * n + read_num[j]] + bias;
+				j += segLen;
+			}
+		}
+	}
+	return vProfile;
+}
+
+/* 256-bit version of sw_sse2_byte: 32 byte lanes. */
+SSW_TARGET_AVX2
+alignment_end* sw_avx2_byte (const int8_t* ref,
+							 int8_t ref_dir,	// 0: forward ref; 1: reverse ref
+							 int32_t refLen,
+							 int32_t readLen,
+							 const uint8_t weight_gapO, /* will be used as - */
+							 const uint8_t weight_gapE, /* will be used as - */
+							 __m256i* vProfile,
+							 uint8_t terminate,
+							 uint8_t bias,
+							 int32_t maskLen,
+							 s_workspace* ws,
+							 sw_state* st) {	/* 0, or the state to resume and save, see sw_sse2_byte */
+
+#define max32(m, vm) { __m128i vm128 = _mm_max_epu8(_mm256_castsi256_si128(vm), _mm256_extracti128_si256((vm), 1)); \
+					   max16(m, vm128); }
+
+	uint8_t max = 0;		                     /* the max alignment score */
+	int32_t end_read = readLen - 1;
+	int32_t end_ref = -1; /* 0_based best alignment ending point; Initialized as isn't aligned -1. */
+	int32_t segLen = (readLen + 31) / 32; /* number of segment */
+
+	uint8_t maxColumn;	/* the largest score of the current column */
+	second_best second;	/* the 2nd best alignment, see second_push */
+
+	/* Define 32 byte 0 vector. */
+	__m256i vZero = _mm256_setzero_si256();
+
+	__m256i* pvHStore = (__m256i*) ws_keep(ws, WS_H_STORE, segLen * sizeof(__m256i), st != 0);
+	__m256i* pvHLoad = (__m256i*) ws_keep(ws, WS_H_LOAD, segLen * sizeof(__m256i), st != 0);
+	__m256i* pvE = (__m256i*) ws_keep(ws, WS_E, segLen * sizeof(__m256i), st != 0);
+	__m256i* pvHmax = (__m256i*) ws_keep(ws, WS_H_MAX, segLen * sizeof(__m256i), st != 0);
+
+	int32_t i, j;
+	__m256i vGapO = _mm256_set1_epi8(weight_gapO);
+	__m256i vGapE = _mm256_set1_epi8(weight_gapE);
+	__m256i vBias = _mm256_set1_epi8(bias);
+
+	__m256i vMaxScore = vZero; /* Trace the highest score of the whole SW matrix. */
+	__m256i vMaxMark = vZero; /* Trace the highest score till the previous column. */
+	__m256i vTemp;
+	int64_t base = st ? st->offset : 0;	/* position of ref in the whole reference */
+	int32_t begin = 0, end = refLen, step = 1;
+
+	/* The padding rows past the end of the read carry scores from earlier columns into maxColumn. Only let through as 
+	   many of them as the 16-lane layout of sw_sse2_byte has, so score2 and ref_end2 do not depend on the kernel width. */
+	__m256i* pvMask = (__m256i*) ws_get(ws, WS_MASK, segLen * sizeof(__m256i));
+	int32_t rows = (readLen + 15) / 16 * 16;
+	for (j = 0; LIKELY(j < segLen); ++j) {
+		uint8_t* m = (uint8_t*)(pvMask + j);
+		for (i = 0; i < 32; ++i) m[i] = i * segLen + j < rows ? 0xff : 0;
+	}
+
+	/* outer loop to process the reference sequence */
+	if (ref_dir == 1) {
+		begin = refLen - 1;
+		end = -1;
+		step = -1;
+	}
+	if (st) {	/* resume; a lane of vMaxScore below max never changes the result, so max stands for all of them */
+		max = st->max;
+		end_ref = -1;
+		second = st->second;
+		vMaxScore = vMaxMark = _mm256_set1_epi8(max);
+	} else second_init(&second, ws, refLen, maskLen, maskLen, step);
+	for (i = begin; LIKELY(i != end); i += step) {
+		int32_t cmp;
+		__m256i e, vF = vZero, vMaxColumn = vZero;
+
+		__m256i vH = pvHStore[segLen - 1];
+		vH = slli_byte_avx2 (vH); /* Shift the 256-bit value in vH left by 1 byte. */
+		__m256i* vP = vProfile + ref[i] * segLen; /* Right part of the vProfile */
+
+		/* Swap the 2 H buffers. */
+		__m256i* pv = pvHLoad;
+		pvHLoad = pvHStore;
+		pvHStore = pv;
+
+		/* inner loop to process the query sequence */
+		for (j = 0; LIKELY(j < segLen); ++j) {
+			vH = _mm256_adds_epu8(vH, _mm256_load_si256(vP + j));
+			vH = _mm256_subs_epu8(vH, vBias); /* vH will be always > 0 */
+
+			/* Get max from vH, vE and vF. */
+			e = _mm256_load_si256(pvE + j);
+			vH = _mm256_max_epu8(vH, e);
+			vH = _mm256_max_epu8(vH, vF);
+			vMaxColumn = _mm256_max_epu8(vMaxColumn, _mm256_and_si256(vH, pvMask[j]));
+
+			/* Save vH values. */
+			_mm256_store_si256(pvHStore + j, vH);
+
+			/* Update vE value. */
+			vH = _mm256_subs_epu8(vH, vGapO); /* saturation arithmetic, result >= 0 */
+			e = _mm256_subs_epu8(e, vGapE);
+			e = _mm256_max_epu8(e, vH);
+			_mm256_store_si256(pvE + j, e);
+
+			/* Update vF value. */
+			vF = _mm256_subs_epu8(vF, vGapE);
+			vF = _mm256_max_epu8(vF, vH);
+
+			/* Load the next vH. */
+			vH = _mm256_load_si256(pvHLoad + j);
+		}
+
+		/* Lazy_F loop, see sw_sse2_byte */
+		j = 0;
+		vH = _mm256_load_si256 (pvHStore + j);
+		vF = slli_byte_avx2 (vF);
+		vTemp = _mm256_subs_epu8 (vH, vGapO);
+		vTemp = _mm256_subs_epu8 (vF, vTemp);
+		vTemp = _mm256_cmpeq_epi8 (vTemp, vZero);
+		cmp  = _mm256_movemask_epi8 (vTemp);
+
+		while (cmp != -1) {
+			vH = _mm256_max_epu8 (vH, vF);
+			vMaxColumn = _mm256_max_epu8(vMaxColumn, _mm256_and_si256(vH, pvMask[j]));
+			_mm256_store_si256 (pvHStore + j, vH);
+			vF = _mm256_subs_epu8 (vF, vGapE);
+			j++;
+			if (j >= segLen) {
+				j = 0;
+				vF = slli_byte_avx2 (vF);
+			}
+			vH = _mm256_load_si256 (pvHStore + j);
+
+			vTemp = _mm256_subs_epu8 (vH, vGapO);
+			vTemp = _mm256_subs_epu8 (vF, vTemp);
+			vTemp = _mm256_cmpeq_epi8 (vTemp, vZero);
+			cmp  = _mm256_movemask_epi8 (vTemp);
+		}
+
+		vMaxScore = _mm256_max_epu8(vMaxScore, vMaxColumn);
+		vTemp = _mm256_cmpeq_epi8(vMaxMark, vMaxScore);
+		cmp = _mm256_movemask_epi8(vTemp);
+		if (cmp != -1) {
+			uint8_t temp;
+			vMaxMark = vMaxScore;
+			max32(temp, vMaxScore);
+
+			if (LIKELY(temp > max)) {
+				max = temp;
+				if (max + bias >= 255) break;	//overflow
+				end_ref = i;
+
+				/* Store the column with the highest alignment score in order to trace the alignment ending position on read. */
+				for (j = 0; LIKELY(j < segLen); ++j) pvHmax[j] = pvHStore[j];
+			}
+		}
+
+		/* Record the max score of current column. */
+		max32(maxColumn, vMaxColumn);
+		second_push(&second, base + i, maxColumn, end_ref == i);
+		if (maxColumn == terminate) break;
+		if (st && UNLIKELY(stop_early(st, max, maxColumn, end - i - 1, readLen))) break;	/* forward only */
+		if (UNLIKELY(st && st->stop && max >= st->stop)) {	/* the next column may overflow */
+			st->next = i + 1;
+			break;
+		}
+	}
+
+	/* Trace the alignment ending position on read. */
+	uint8_t *t = (uint8_t*)pvHmax;
+	int32_t column_len = segLen * 32;
+	for (i = 0; LIKELY(i < column_len); ++i, ++t) {
+		int32_t temp;
+		if (*t == max) {
+			temp = i / 32 + i % 32 * segLen;
+			if (temp < end_read) end_read = temp;
+		}
+	}
+
+	if (st) {
+		if (pvHStore != ws->buf[WS_H_STORE]) memcpy(ws->buf[WS_H_STORE], pvHStore, segLen * sizeof(__m256i));
+		st->max = max;
+		st->end_read = end_read;
+		if (end_ref >= 0) st->end_ref = base + end_ref;
+		st->second = second;
+		return 0;
+	}
+
+
+	/* Find the most possible 2nd best alignment. */
+	alignment_end* bests = (alignment_end*) ws_calloc(ws, WS_BESTS, 2 * sizeof(alignment_end));
+	bests[0].score = max + bias >= 255 ? 255 : max;
+	bests[0].ref = end_ref;
+	bests[0].read = end_read;
+
+	second_find(&second, bests + 1);
+
+	return bests;
+}
+
+/* 256-bit version of sw_sse2_byte_dual. */
+SSW_TARGET_AVX2
+static void sw_avx2_byte_dual (const int8_t* ref,
+							   int32_t refLen,
+							   int32_t readLen,
+							   const uint8_t weight_gapO, /* will be used as - */
+							   const uint8_t weight_gapE, /* will be used as - */
+							   __m256i** vProfile,	/* the profiles of the 2 reads */
+							   uint8_t bias,
+							   s_workspace* ws,
+							   sw_state* st) {
+
+	int32_t segLen = (readLen + 31) / 32; /* number of segment */
+	__m256i vZero = _mm256_setzero_si256();
+	__m256i vGapO = _mm256_set1_epi8(weight_gapO);
+	__m256i vGapE = _mm256_set1_epi8(weight_gapE);
+	__m256i vBias = _mm256_set1_epi8(bias);
+	__m256i vTemp, vH[2], vF[2], vMaxColumn[2], vMaxScore[2], vMaxMark[2];
+	__m256i* pvHStore[2] = {(__m256i*)ws->buf[WS_H_STORE], (__m256i*)ws->buf[WS_DUAL_H_STORE]};
+	__m256i* pvHLoad[2] = {(__m256i*)ws->buf[WS_H_LOAD], (__m256i*)ws->buf[WS_DUAL_H_LOAD]};
+	__m256i* pvE[2] = {(__m256i*)ws->buf[WS_E], (__m256i*)ws->buf[WS_DUAL_E]};
+	__m256i* pvHmax[2] = {(__m256i*)ws->buf[WS_H_MAX], (__m256i*)ws->buf[WS_DUAL_H_MAX]};
+	uint8_t max[2], maxColumn;
+	int32_t i, j, s, live[2] = {1, 1};
+
+	/* The padding rows past the end of the read, see sw_avx2_byte; the reads have the same length. */
+	__m256i* pvMask = (__m256i*) ws_get(ws, WS_MASK, segLen * sizeof(__m256i));
+	int32_t rows = (readLen + 15) / 16 * 16;
+	for (j = 0; LIKELY(j < segLen); ++j) {
+		uint8_t* m = (uint8_t*)(pvMask + j);
+		for (i = 0; i < 32; ++i) m[i] = i * segLen + j < rows ? 0xff : 0;
+	}
+
+	for (s = 0; s < 2; ++s) {	/* see sw_avx2_byte */
+		max[s] = st[s].max;
+		vMaxScore[s] = vMaxMark[s] = _mm256_set1_epi8(max[s]);
+	}
+	for (i = 0; LIKELY(i < refLen) && live[0] && live[1]; ++i) {
+		int32_t cmp, row = ref[i] * segLen;
+		__m256i* vP0 = vProfile[0] + row, *vP1 = vProfile[1] + row, *pv, e;
+
+		for (s = 0; s < 2; ++s) {
+			vF[s] = vMaxColumn[s] = vZero;
+			vH[s] = slli_byte_avx2 (pvHStore[s][segLen - 1]);
+
+			/* Swap the 2 H buffers. */
+			pv = pvHLoad[s];
+			pvHLoad[s] = pvHStore[s];
+			pvHStore[s] = pv;
+		}
+
+		/* inner loop to process the query sequence, see sw_sse2_byte_dual */
+		for (j = 0; LIKELY(j < segLen); ++j) {
+			__m256i m = pvMask[j];
+			vH[0] = _mm256_adds_epu8(vH[0], _mm256_load_si256(vP0 + j));
+			vH[1] = _mm256_adds_epu8(vH[1], _mm256_load_si256(vP1 + j));
+			vH[0] = _mm256_subs_epu8(vH[0], vBias);
+			vH[1] = _mm256_subs_epu8(vH[1], vBias);
+
+			e = _mm256_load_si256(pvE[0] + j);
+			vH[0] = _mm256_max_epu8(vH[0], e);
+			vH[0] = _mm256_max_epu8(vH[0], vF[0]);
+			vMaxColumn[0] = _mm256_max_epu8(vMaxColumn[0], _mm256_and_si256(vH[0], m));
+			_mm256_store_si256(pvHStore[0] + j, vH[0]);
+			vH[0] = _mm256_subs_epu8(vH[0], vGapO);
+			e = _mm256_subs_epu8(e, vGapE);
+			e = _mm256_max_epu8(e, vH[0]);
+			_mm256_store_si256(pvE[0] + j, e);
+			vF[0] = _mm256_subs_epu8(vF[0], vGapE);
+			vF[0] = _mm256_max_epu8(vF[0], vH[0]);
+			vH[0] = _mm256_load_si256(pvHLoad[0] + j);
+
+			e = _mm256_load_si256(pvE[1] + j);
+			vH[1] = _mm256_max_epu8(vH[1], e);
+			vH[1] = _mm256_max_epu8(vH[1], vF[1]);
+			vMaxColumn[1] = _mm256_max_epu8(vMaxColumn[1], _mm256_and_si256(vH[1], m));
+			_mm256_store_si256(pvHStore[1] + j, vH[1]);
+			vH[1] = _mm256_subs_epu8(vH[1], vGapO);
+			e = _mm256_subs_epu8(e, vGapE);
+			e = _mm256_max_epu8(e, vH[1]);
+			_mm256_store_si256(pvE[1] + j, e);
+			vF[1] = _mm256_subs_epu8(vF[1], vGapE);
+			vF[1] = _mm256_max_epu8(vF[1], vH[1]);
+			vH[1] = _mm256_load_si256(pvHLoad[1] + j);
+		}
+
+		for (s = 0; s < 2; ++s) {
+			__m256i h, f = slli_byte_avx2 (vF[s]);
+			int8_t best = 0;
+
+			/* Lazy_F loop, see sw_sse2_byte */
+			j = 0;
+			h = _mm256_load_si256 (pvHStore[s] + j);
+			vTemp = _mm256_subs_epu8 (h, vGapO);
+			vTemp = _mm256_subs_epu8 (f, vTemp);
+			vTemp = _mm256_cmpeq_epi8 (vTemp, vZero);
+			cmp  = _mm256_movemask_epi8 (vTemp);
+			while (cmp != -1) {
+				h = _mm256_max_epu8 (h, f);
+				vMaxColumn[s] = _mm256_max_epu8(vMaxColumn[s], _mm256_and_si256(h, pvMask[j]));
+				_mm256_store_si256 (pvHStore[s] + j, h);
+				f = _mm256_subs_epu8 (f, vGapE);
+				j++;
+				if (j >= segLen) {
+					j = 0;
+					f = slli_byte_avx2 (f);
+				}
+				h = _mm256_load_si256 (pvHStore[s] + j);
+
+				vTemp = _mm256_subs_epu8 (h, vGapO);
+				vTemp = _mm256_subs_epu8 (f, vTemp);
+				vTemp = _mm256_cmpeq_epi8 (vTemp, vZero);
+				cmp  = _mm256_movemask_epi8 (vTemp);
+			}
+
+			vMaxScore[s] = _mm256_max_epu8(vMaxScore[s], vMaxColumn[s]);
+			vTemp = _mm256_cmpeq_epi8(vMaxMark[s], vMaxScore[s]);
+			cmp = _mm256_movemask_epi8(vTemp);
+			if (cmp != -1) {
+				uint8_t temp;
+				vMaxMark[s] = vMaxScore[s];
+				max32(temp, vMaxScore[s]);
+
+				if (LIKELY(temp > max[s])) {
+					max[s] = temp;
+					if (max[s] + bias >= 255) {	//overflow
+						live[s] = 0;
+						continue;
+					}
+					st[s].end_ref = i;
+					best = 1;
+					for (j = 0; LIKELY(j < segLen); ++j) pvHmax[s][j] = pvHStore[s][j];
+				}
+			}
+
+			max32(maxColumn, vMaxColumn[s]);
+			second_push(&st[s].second, i, maxColumn, best);
+			if (UNLIKELY(stop_early(&st[s], max[s], maxColumn, refLen - i - 1, readLen))) live[s] = 0;
+			else if (UNLIKELY(st[s].stop && max[s] >= st[s].stop)) {	/* the next column may overflow */
+				st[s].next = i + 1;
+				live[s] = 0;
+			}
+		}
+	}
+
+	for (s = 0; s < 2; ++s) {	/* save the state of each read, see sw_avx2_byte */
+		uint8_t *t = (uint8_t*)pvHmax[s];
+		int32_t slot = s ? WS_DUAL_H_STORE : WS_H_STORE;
+		st[s].end_read = readLen - 1;
+		for (j = 0; LIKELY(j < segLen * 32); ++j, ++t) {
+			if (*t == max[s] && j / 32 + j % 32 * segLen < st[s].end_read) st[s].end_read = j / 32 + j % 32 * segLen;
+		}
+		if (pvHStore[s] != ws->buf[slot]) memcpy(ws->buf[slot], pvHStore[s], segLen * sizeof(__m256i));
+		st[s].max = max[s];
+		st[s].offset = live[s] ? i : refLen;
+	}
+}
+
+__m256i* qP_word_avx2 (const int8_t* read_num,
+					   const int8_t* mat,
+					   const int32_t readLen,
+					   const int32_t n,
+					   void* buf) {	/* where to write the profile; 0: allocate it */
+
+	int32_t segLen = (readLen + 15) / 16;
+	__m256i* vProfile = buf ? (__m256i*)buf : (__m256i*)_mm_malloc(n * segLen * sizeof(__m256i), 32);
+	int16_t* t = (int16_t*)vProfile;
+	int32_t nt, i, j;
+	int32_t segNum;
+
+	for (nt = 0; LIKELY(nt < n); nt ++) {
+		for (i = 0; i < segLen; i ++) {
+			j = i;
+			for (segNum = 0; LIKELY(segNum < 16) ; segNum ++) {
+				*t++ = j>= readLen ? 0 : mat[nt * n + read_num[j]];
+				j += segLen;
+			}
+		}
+	}
+	return vProfile;
+}
+
+/* 256-bit version of sw_sse2_word: 16 word lanes. */
+SSW_TARGET_AVX2
+alignment_end* sw_avx2_word (const int8_t* ref,
+							 int8_t ref_dir,	// 0: forward ref; 1: reverse ref
+							 int32_t refLen,
+							 int32_t readLen,
+							 const uint8_t weight_gapO, /* will be used as - */
+							 const uint8_t weight_gapE, /* will be used as - */
+							 __m256i* vProfile,
+							 uint16_t terminate,
+							 int32_t maskLen,
+							 s_workspace* ws,
+							 sw_state* st) {	/* 0, or the state to resume and save, see sw_sse2_byte */
+
+#define max16_avx2(m, vm) { __m128i vm128 = _mm_max_epi16(_mm256_castsi256_si128(vm), _mm256_extracti128_si256((vm), 1)); \
+							max8(m, vm128); }
+
+	uint16_t max = 0;		                     /* the max alignment score */
+	int32_t end_read = readLen - 1;
+	int32_t end_ref = 0; /* 1_based best alignment ending point; Initialized as isn't aligned - 0. */
+	int32_t segLen = (readLen + 15) / 16; /* number of segment */
+
+	uint16_t maxColumn;	/* the largest score of the current column */
+	second_best second;	/* the 2nd best alignment, see second_push */
+
+	__m256i vZero = _mm256_setzero_si256();
+
+	__m256i* pvHStore = (__m256i*) ws_keep(ws, WS_H_STORE, segLen * sizeof(__m256i), st != 0);
+	__m256i* pvHLoad = (__m256i*) ws_keep(ws, WS_H_LOAD, segLen * sizeof(__m256i), st != 0);
+	__m256i* pvE = (__m256i*) ws_keep(ws, WS_E, segLen * sizeof(__m256i), st != 0);
+	__m256i* pvHmax = (__m256i*) ws_keep(ws, WS_H_MAX, segLen * sizeof(__m256i), st != 0);
+
+	int32_t i, j, k;
+	__m256i vGapO = _mm256_set1_epi16(weight_gapO);
+	__m256i vGapE = _mm256_set1_epi16(weight_gapE);
+
+	__m256i vMaxScore = vZero; /* Trace the highest score of the whole SW matrix. */
+	__m256i vMaxMark = vZero; /* Trace the highest score till the previous column. */
+	__m256i vTemp;
+	int64_t base = st ? st->offset : 0;	/* position of ref in the whole reference */
+	int32_t begin = 0, end = refLen, step = 1;
+
+	/* Keep maxColumn the same as with the 8-lane layout, see sw_avx2_byte. */
+	__m256i* pvMask = (__m256i*) ws_get(ws, WS_MASK, segLen * sizeof(__m256i));
+	int32_t rows = (readLen + 7) / 8 * 8;
+	for (j = 0; LIKELY(j < segLen); ++j) {
+		uint16_t* m = (uint16_t*)(pvMask + j);
+		for (i = 0; i < 16; ++i) m[i] = i * segLen + j < rows ? 0xffff : 0;
+	}
+
+	/* outer loop to process the reference sequence */
+	if (ref_dir == 1) {
+		begin = refLen - 1;
+		end = -1;
+		step = -1;
+	}
+	if (st) {	/* resume, see sw_avx2_byte */
+		max = st->max;
+		end_ref = -1;
+		second = st->second;
+		vMaxScore = vMaxMark = _mm256_set1_epi16(max);
+	} else second_init(&second, ws, refLen, maskLen, maskLen - 1, step);
+	for (i = begin; LIKELY(i != end); i += step) {
+		int32_t cmp;
+		__m256i e, vF = vZero;
+		__m256i vH = pvHStore[segLen - 1];
+		vH = slli_word_avx2 (vH); /* Shift the 256-bit value in vH left by 2 byte. */
+
+		/* Swap the 2 H buffers. */
+		__m256i* pv = pvHLoad;
+
+		__m256i vMaxColumn = vZero; /* vMaxColumn is used to record the max values of column i. */
+
+		__m256i* vP = vProfile + ref[i] * segLen; /* Right part of the vProfile */
+		pvHLoad = pvHStore;
+		pvHStore = pv;
+
+		/* inner loop to process the query sequence */
+		for (j = 0; LIKELY(j < segLen); j ++) {
+			vH = _mm256_adds_epi16(vH, _mm256_load_si256(vP + j));
+
+			/* Get max from vH, vE and vF. */
+			e = _mm256_load_si256(pvE + j);
+			vH = _mm256_max_epi16(vH, e);
+			vH = _mm256_max_epi16(vH, vF);
+			vMaxColumn = _mm256_max_epi16(vMaxColumn, _mm256_and_si256(vH, pvMask[j]));
+
+			/* Save vH values. */
+			_mm256_store_si256(pvHStore + j, vH);
+
+			/* Update vE value. */
+			vH = _mm256_subs_epu16(vH, vGapO); /* saturation arithmetic, result >= 0 */
+			e = _mm256_subs_epu16(e, vGapE);
+			e = _mm256_max_epi16(e, vH);
+			_mm256_store_si256(pvE + j, e);
+
+			/* Update vF value. */
+			vF = _mm256_subs_epu16(vF, vGapE);
+			vF = _mm256_max_epi16(vF, vH);
+
+			/* Load the next vH. */
+			vH = _mm256_load_si256(pvHLoad + j);
+		}
+
+		/* Lazy_F loop, see sw_sse2_word */
+		for (k = 0; LIKELY(k < 16); ++k) {
+			vF = slli_word_avx2 (vF);
+			for (j = 0; LIKELY(j < segLen); ++j) {
+				vH = _mm256_load_si256(pvHStore + j);
+				vH = _mm256_max_epi16(vH, vF);
+				_mm256_store_si256(pvHStore + j, vH);
+				vH = _mm256_subs_epu16(vH, vGapO);
+				vF = _mm256_subs_epu16(vF, vGapE);
+				if (UNLIKELY(! _mm256_movemask_epi8(_mm256_cmpgt_epi16(vF, vH)))) goto end;
+			}
+		}
+
+end:
+		vMaxScore = _mm256_max_epi16(vMaxScore, vMaxColumn);
+		vTemp = _mm256_cmpeq_epi16(vMaxMark, vMaxScore);
+		cmp = _mm256_movemask_epi8(vTemp);
+		if (cmp != -1) {
+			uint16_t temp;
+			vMaxMark = vMaxScore;
+			max16_avx2(temp, vMaxScore);
+
+			if (LIKELY(temp > max)) {
+				max = temp;
+				if (max == 32767) break;	//overflow
+				end_ref = i;
+				for (j = 0; LIKELY(j < segLen); ++j) pvHmax[j] = pvHStore[j];
+			}
+		}
+
+		/* Record the max score of current column. */
+		max16_avx2(maxColumn, vMaxColumn);
+		second_push(&second, base + i, maxColumn, end_ref == i);
+		if (maxColumn == terminate) break;
+		if (st && UNLIKELY(stop_early(st, max, maxColumn, end - i - 1, readLen))) break;	/* forward only */
+	}
+
+	/* Trace the alignment ending position on read. */
+	uint16_t *t = (uint16_t*)pvHmax;
+	int32_t column_len = segLen * 16;
+	for (i = 0; LIKELY(i < column_len); ++i, ++t) {
+		int32_t temp;
+		if (*t == max) {
+			temp = i / 16 + i % 16 * segLen;
+			if (temp < end_read) end_read = temp;
+		}
+	}
+
+	if (st) {
+		if (pvHStore != ws->buf[WS_H_STORE]) memcpy(ws->buf[WS_H_STORE], pvHStore, segLen * sizeof(__m256i));
+		st->max = max;
+		st->end_read = end_read;
+		if (end_ref >= 0) st->end_ref = base + end_ref;
+		st->second = second;
+		return 0;
+	}
+
+
+	/* Find the most possible 2nd best alignment. */
+	alignment_end* bests = (alignment_end*) ws_calloc(ws, WS_BESTS, 2 * sizeof(alignment_end));
+	bests[0].score = max;
+	bests[0].ref = end_ref;
+	bests[0].read = end_read;
+
+	second_find(&second, bests + 1);
+
+	return bests;
+}
+
+#endif	// SSW_AVX2
+
+/* Above this many bytes of direction bits, banded_sw and banded_sse2 save the band every few rows during the fill and 
+   recompute the rows from these checkpoints as the trace back reaches them, so the memory no longer grows with the 
+   read length. Define SSW_BAND_MEM to change it. */
+#ifndef SSW_BAND_MEM
+#define SSW_BAND_MEM 134217728
+#endif
+
+/* Integer square root of x >= 0 by Newton steps, so that the checkpoints need no libm. */
+static int64_t isqrt (int64_t x) {
+	int64_t r = x, y;
+	if (x < 2) return x;
+	while ((y = (r + x / r) / 2) < r) r = y;
+	return r;
+}
+
+/* Rows i0 to i1 - 1 of banded_sw. h_b (H of the row before i0) and e_b are updated in place, h_c is the row being 
+   computed. Row i keeps 3 direction bytes per cell at direction + (i - i0) * width_d * 3. Return the max score of 
+   the rows. */
+static int32_t band_rows (const int8_t* ref, 
+						  const int8_t* read, 
+						  int32_t i0, 
+						  int32_t i1, 
+						  int32_t refLen, 
+						  int32_t band_width, 
+						  const uint32_t weight_gapO, 
+						  const uint32_t weight_gapE, 
+						  const int8_t* mat, 
+						  int32_t n, 
+						  int32_t* h_b, 
+						  int32_t* e_b, 
+						  int32_t* h_c, 
+						  int8_t* direction) {
+	int32_t i, j, e, f, temp1, temp2, max = 0, width = band_width * 2 + 3, width_d = band_width * 2 + 1;
+	int8_t* direction_line;
+
+	for (i = i0; LIKELY(i < i1); i ++) {
+		int32_t beg = 0, end = refLen - 1, u = 0, edge;
+		j = i - band_width;	beg = beg > j ? beg : j; // band start
+		j = i + band_width; end = end < j ? end : j; // band end
+		edge = end + 1 < width - 1 ? end + 1 : width - 1;
+		f = h_b[0] = e_b[0] = h_b[edge] = e_b[edge] = h_c[0] = 0;
+		direction_line = direction + (size_t)width_d * (i - i0) * 3;
+
+		for (j = beg; LIKELY(j <= end); j ++) {
+			int32_t b, e1, f1, d, de, df, dh;
+			set_u(u, band_width, i, j);	set_u(e, band_width, i - 1, j); 
+			set_u(b, band_width, i, j - 1); set_u(d, band_width, i - 1, j - 1);
+			set_d(de, band_width, i, j, 0);
+			set_d(df, band_width, i, j, 1);
+			set_d(dh, band_width, i, j, 2);
+
+			temp1 = i == 0 ? -weight_gapO : h_b[e] - weight_gapO;
+			temp2 = i == 0 ? -weight_gapE : e_b[e] - weight_gapE;
+			e_b[u] = temp1 > temp2 ? temp1 : temp2;
+			direction_line[de] = temp1 > temp2 ? 3 : 2;
+	
+			temp1 = h_c[b] - weight_gapO;
+			temp2 = f - weight_gapE;
+			f = temp1 > temp2 ? temp1 : temp2;
+			direction_line[df] = temp1 > temp2 ? 5 : 4;
+			
+			e1 = e_b[u] > 0 ? e_b[u] : 0;
+			f1 = f > 0 ? f : 0;
+			temp1 = e1 > f1 ? e1 : f1;
+			temp2 = h_b[d] + mat[ref[j] * n + read[i]];
+			h_c[u] = temp1 > temp2 ? temp1 : temp2;
+	
+			if (h_c[u] > max) max = h_c[u];
+	
+			if (temp1 <= temp2) direction_line[dh] = 1;
+			else direction_line[dh] = e1 > f1 ? direction_line[de] : direction_line[df];
+		}
+		for (j = 1; j <= u; j ++) h_b[j] = h_c[j];
+	}
+	return max;
+}
+
+/* The width of the band after one of band_width that falls short of the score: twice as wide, but band_max at once 
+   when it is near or narrow, a pass at band_max then costing less than the passes at the widths in between. */
+static int32_t band_next (int32_t band_width, int32_t band_max) {
+	if (band_width < band_max && (band_width * 4 >= band_max || band_max <= 16)) return band_max;
+	return band_width * 2;
+}
+
+/* The band is widened until it holds a path of score. Return 0 on a trace back error or when the memory cannot be 
+   allocated. */
+cigar* banded_sw (const int8_t* ref,
+				 const int8_t* read, 
+				 int32_t refLen, 
+				 int32_t readLen,
+				 int32_t score,
+				 const uint32_t weight_gapO,  /* will be used as - */
+				 const uint32_t weight_gapE,  /* will be used as - */
+				 int32_t band_width,
+				 int32_t band_max,	/* the band holds the best path at this width */
+				 const int8_t* mat,	/* pointer to the weight matrix */
+				 int32_t n) {	
+
+	uint32_t *c = 0, *c1;
+	int32_t i, j, e, f, temp1, temp2, s = 16, l, max = 0, rows = readLen, blocks = 1, block;
+	int32_t width, width_d, *h_b = 0, *e_b = 0, *h_c = 0, *checks = 0;
+	int8_t *direction = 0, *direction_line;
+	cigar* result = 0;
+
+	for (;;) {
+		width = band_width * 2 + 3, width_d = band_width * 2 + 1;
+		if ((size_t)width_d * 3 * readLen > SSW_BAND_MEM) {	/* checkpoints, as in banded_sse2 */
+			rows = SSW_BAND_MEM / 2 / (width_d * 3);
+			j = (int32_t)isqrt((int64_t)readLen * width * 2 * sizeof(int32_t) / (width_d * 3));
+			rows = rows > j ? rows : j;
+			rows = rows < readLen ? (rows > 0 ? rows : 1) : readLen;
+		} else rows = readLen;
+		blocks = (readLen + rows - 1) / rows;
+		free(h_b);
+		free(e_b);
+		free(h_c);
+		free(direction);
+		free(checks);
+		h_b = (int32_t*)calloc(width, sizeof(int32_t));
+		e_b = (int32_t*)calloc(width, sizeof(int32_t));
+		h_c = (int32_t*)calloc(width, sizeof(int32_t));
+		direction = (int8_t*)malloc((size_t)width_d * 3 * rows);
+		checks = blocks > 1 ? (int32_t*)malloc((size_t)blocks * width * 2 * sizeof(int32_t)) : 0;
+		if (UNLIKELY(h_b == 0 || e_b == 0 || h_c == 0 || direction == 0 || (blocks > 1 && checks == 0))) goto fail;
+		for (block = 0, max = 0; block < blocks; ++block) {
+			int32_t m, i1 = (block + 1) * rows < readLen ? (block + 1) * rows : readLen;
+			if (blocks > 1) {
+				memcpy(checks + (size_t)block * width * 2, h_b, width * sizeof(int32_t));
+				memcpy(checks + ((size_t)block * 2 + 1) * width, e_b, width * sizeof(int32_t));
+			}
+			m = band_rows(ref, read, block * rows, i1, refLen, band_width, weight_gapO, weight_gapE, mat, n, h_b, e_b, h_c, direction);
+			max = max > m ? max : m;
+		}
+		if (LIKELY(max >= score) || band_width >= refLen + readLen) break;	// wider bands give the same scores
+		band_width = band_next(band_width, band_max);
+	}
+	block = blocks - 1;	// the direction bytes of the last block are still there
+	c = (uint32_t*)malloc(16 * sizeof(uint32_t));
+	result = (cigar*)malloc(sizeof(cigar));
+	if (UNLIKELY(c == 0 || result == 0)) goto fail;
+
+	// trace back
+	i = readLen - 1;
+	j = refLen - 1;
+	e = 0;	// Count the number of M, D or I.
+	l = 0;	// record length of current cigar
+	f = max = 0; // M
+	temp2 = 2;	// h
+	while (LIKELY(i > 0)) {
+		if (i < block * rows) {	// recompute the block of row i from its checkpoint
+			block = i / rows;
+			memcpy(h_b, checks + (size_t)block * width * 2, width * sizeof(int32_t));
+			memcpy(e_b, checks + ((size_t)block * 2 + 1) * width, width * sizeof(int32_t));
+			band_rows(ref, read, block * rows, (block + 1) * rows, refLen, band_width, weight_gapO, weight_gapE, mat, n, h_b, e_b, h_c, direction);
+		}
+		direction_line = direction + (size_t)width_d * (i - block * rows) * 3;
+		set_d(temp1, band_width, i, j, temp2);
+		switch (direction_line[temp1]) {
+			case 1: 
+				--i;
+				--j;
+				temp2 = 2;
+				f = 0;	// M
+				break;
+			case 2:
+			 	--i;
+				temp2 = 0;	// e
+				f = 1;	// I
+				break;		
+			case 3:
+				--i;
+				temp2 = 2;
+				f = 1;	// I
+				break;
+			case 4:
+				--j;
+				temp2 = 1;
+				f = 2;	// D
+				break;
+			case 5:
+				--j;
+				temp2 = 2;
+				f = 2;	// D
+				break;
+			default: 
+				fprintf(stderr, "Trace back error: %d.\n", direction_line[temp1 - 1]);
+				free(result);
+				result = 0;
+				goto end;
+		}
+		if (f == max) ++e;
+		else {
+			++l;
+			while (l >= s) {
+				++s;
+				kroundup32(s);
+				c = (uint32_t*)realloc(c, s * sizeof(uint32_t));
+			}
+			c[l - 1] = e<<4|max;
+			max = f;
+			e = 1;
+		}
+	}
+	if (f == 0) {
+		++l;
+		while (l >= s) {
+			++s;
+			kroundup32(s);
+			c = (uint32_t*)realloc(c, s * sizeof(uint32_t));
+		}
+		c[l - 1] = (e+1)<<4;
+	}else {
+		l += 2;
+		while (l >= s) {
+			++s;
+			kroundup32(s);
+			c = (uint32_t*)realloc(c, s * sizeof(uint32_t));
+		}
+		c[l - 2] = e<<4|f;
+		c[l - 1] = 16;	// 1M
+	}
+
+	// reverse cigar
+	c1 = (uint32_t*)malloc(l * sizeof(uint32_t));
+	s = 0;
+	e = l - 1;
+	while (LIKELY(s <= e)) {			
+		c1[s] = c[e];		
+		c1[e] = c[s];		
+		++ s;					
+		-- e;						
+	}								
+	result->seq = c1;
+	result->length = l;
+
+end:
+	free(checks);
+	free(direction);
+	free(h_c);
+	free(e_b);
+	free(h_b);
+	free(c);
+	return result;
+
+fail:
+	fprintf(stderr, "The memory of the banded alignment cannot be allocated.\n");
+	free(result);
+	result = 0;
+	goto end;
+}
+
+/* Rows i0 to i1 - 1 of banded_sse2 with 8 16-bit lanes. The band is stored as in banded_sw, cell (i, j) at 
+   u = j - max(i - band_width, 0) + 1, so the diagonal and vertical neighbours are two unaligned loads of the previous 
+   row; the horizontal gap F is a prefix max over the lanes. h_b (H of the row before i0) and e_b are updated in 
+   place. Each group of 8 cells of row i keeps a word of direction bits at direction + (i - i0) * segs: byte 0, H 
+   from a gap; byte 1, H from E rather than F; byte 2, E opened; byte 3, F opened. Return the max score of the rows, 
+   32767 if it saturated. */
+static int32_t band_word (const int8_t* read,
+						  int32_t i0,
+						  int32_t i1,
+						  const int16_t* profile,	/* substitution scores of each residue along the reference */
+						  int32_t stride,
+						  int32_t refLen,
+						  int32_t band_width,
+						  const uint32_t weight_gapO,
+						  const uint32_t weight_gapE,
+						  void** h_b,	/* int16_t */
+						  void** h_c,
+						  int16_t* e_b,
+						  uint32_t* direction,
+						  int32_t segs) {
+
+	int32_t i, j, k, u, l, max, width = band_width * 2 + 3;
+	void *h_t;
+	__m128i vZero = _mm_set1_epi32(0);
+	__m128i vGapO = _mm_set1_epi16(weight_gapO);
+	__m128i vGapE = _mm_set1_epi16(weight_gapE);
+	__m128i vGapE2 = _mm_set1_epi16(weight_gapE * 2);
+	__m128i vGapE4 = _mm_set1_epi16(weight_gapE * 4);
+	__m128i vMin1 = _mm_set_epi16(0, 0, 0, 0, 0, 0, 0, 0x8000);	/* shifted in below the first lane */
+	__m128i vMin2 = _mm_set_epi16(0, 0, 0, 0, 0, 0, 0x8000, 0x8000);
+	__m128i vMin4 = _mm_set_epi16(0, 0, 0, 0, 0x8000, 0x8000, 0x8000, 0x8000);
+	__m128i vLane = _mm_set_epi16(7, 6, 5, 4, 3, 2, 1, 0);
+	__m128i vMax = vZero;
+
+	for (i = i0; LIKELY(i < i1); i ++) {
+		int32_t beg = 0, end = refLen - 1, edge, up = i > band_width;	// up: the row above starts one cell left
+		int16_t *hb = (int16_t*)*h_b, *hc = (int16_t*)*h_c;
+		const int16_t* p;
+		uint32_t* direction_line = direction + (size_t)segs * (i - i0);
+		__m128i vHp = vZero, vFp = vZero;	// H and F of the previous segment; 0 left of the band
+		j = i - band_width;	beg = beg > j ? beg : j; // band start
+		j = i + band_width; end = end < j ? end : j; // band end
+		edge = end + 1 < width - 1 ? end + 1 : width - 1;
+		hb[0] = hb[edge] = e_b[edge] = 0;
+		p = profile + read[i] * stride + beg;
+		l = end - beg + 1;
+
+		for (u = 1, k = 0; LIKELY(u <= l); u += 8, ++k) {
+			__m128i vH, vE, vF, vD, vT, vGap, mGap, mE, mF;
+			vH = _mm_subs_epi16(_mm_loadu_si128((__m128i*)(hb + u + up)), vGapO);
+			vE = _mm_subs_epi16(_mm_loadu_si128((__m128i*)(e_b + u + up)), vGapE);
+			mE = _mm_cmpgt_epi16(vH, vE);
+			vE = _mm_max_epi16(vH, vE);
+			_mm_storeu_si128((__m128i*)(e_b + u), vE);
+			vE = _mm_max_epi16(vE, vZero);
+			vD = _mm_adds_epi16(_mm_loadu_si128((__m128i*)(hb + u - 1 + up)), _mm_loadu_si128((__m128i*)(p + u - 1)));
+
+			/* F(u) = max(H(u-1) - gapO, F(u-1) - gapE): the first lane comes from the previous segment, the others
+			   are scanned over 1, 2 and 4 lanes. H(u-1) without its F term is enough, F(u-1) - gapO never wins. */
+			vT = _mm_max_epi16(_mm_subs_epi16(vHp, vGapO), _mm_subs_epi16(vFp, vGapE));
+			vF = _mm_max_epi16(vE, vD);
+			vF = _mm_or_si128(_mm_slli_si128(_mm_subs_epi16(vF, vGapO), 2), _mm_srli_si128(vT, 14));
+			vF = _mm_max_epi16(vF, _mm_subs_epi16(_mm_or_si128(_mm_slli_si128(vF, 2), vMin1), vGapE));
+			vF = _mm_max_epi16(vF, _mm_subs_epi16(_mm_or_si128(_mm_slli_si128(vF, 4), vMin2), vGapE2));
+			vF = _mm_max_epi16(vF, _mm_subs_epi16(_mm_or_si128(_mm_slli_si128(vF, 8), vMin4), vGapE4));
+
+			vT = _mm_max_epi16(vF, vZero);
+			vGap = _mm_max_epi16(vE, vT);
+			mGap = _mm_packs_epi16(_mm_cmpgt_epi16(vGap, vD), _mm_cmpgt_epi16(vE, vT));
+			vH = _mm_max_epi16(vGap, vD);
+			vT = _mm_subs_epi16(_mm_or_si128(_mm_slli_si128(vH, 2), _mm_srli_si128(vHp, 14)), vGapO);
+			mF = _mm_cmpgt_epi16(vT, _mm_subs_epi16(_mm_or_si128(_mm_slli_si128(vF, 2), _mm_srli_si128(vFp, 14)), vGapE));
+			_mm_storeu_si128((__m128i*)(hc + u), vH);
+			direction_line[k] = _mm_movemask_epi8(mGap) | (uint32_t)_mm_movemask_epi8(_mm_packs_epi16(mE, mF)) << 16;
+			vMax = _mm_max_epi16(vMax, _mm_and_si128(vH, _mm_cmpgt_epi16(_mm_set1_epi16(l - u + 1), vLane)));
+			vHp = vH;
+			vFp = vF;
+		}
+		h_t = *h_b; *h_b = *h_c; *h_c = h_t;
+	}
+	max8(max, vMax);
+	return max;
+}
+
+/* 32-bit version of band_word, with 4 lanes. The direction bits of 4 cells take a half word: bits 0-3, H from a 
+   gap; 4-7, H from E rather than F; 8-11, E opened; 12-15, F opened. */
+static int32_t band_dword (const int8_t* read,
+						   int32_t i0,
+						   int32_t i1,
+						   const int32_t* profile,
+						   int32_t stride,
+						   int32_t refLen,
+						   int32_t band_width,
+						   const uint32_t weight_gapO,
+						   const uint32_t weight_gapE,
+						   void** h_b,	/* int32_t */
+						   void** h_c,
+						   int32_t* e_b,
+						   uint32_t* direction,
+						   int32_t segs) {
+
+	int32_t i, j, k, u, l, max, width = band_width * 2 + 3;
+	void *h_t;
+	__m128i vZero = _mm_set1_epi32(0);
+	__m128i vGapO = _mm_set1_epi32(weight_gapO);
+	__m128i vGapE = _mm_set1_epi32(weight_gapE);
+	__m128i vGapE2 = _mm_set1_epi32(weight_gapE * 2);
+	__m128i vMin1 = _mm_set_epi32(0, 0, 0, -0x40000000);	/* shifted in below the first lane; E and F stay above -gapO */
+	__m128i vMin2 = _mm_set_epi32(0, 0, -0x40000000, -0x40000000);
+	__m128i vLane = _mm_set_epi32(3, 2, 1, 0);
+	__m128i vMax = vZero;
+
+	for (i = i0; LIKELY(i < i1); i ++) {
+		int32_t beg = 0, end = refLen - 1, edge, up = i > band_width;
+		int32_t *hb = (int32_t*)*h_b, *hc = (int32_t*)*h_c;
+		const int32_t* p;
+		uint16_t* direction_line = (uint16_t*)(direction + (size_t)segs * (i - i0));
+		__m128i vHp = vZero, vFp = vZero;
+		j = i - band_width;	beg = beg > j ? beg : j; // band start
+		j = i + band_width; end = end < j ? end : j; // band end
+		edge = end + 1 < width - 1 ? end + 1 : width - 1;
+		hb[0] = hb[edge] = e_b[edge] = 0;
+		p = profile + read[i] * stride + beg;
+		l = end - beg + 1;
+
+		for (u = 1, k = 0; LIKELY(u <= l); u += 4, ++k) {
+			__m128i vH, vE, vF, vD, vT, vGap, mGap, mE, mF;
+			vH = _mm_sub_epi32(_mm_loadu_si128((__m128i*)(hb + u + up)), vGapO);
+			vE = _mm_sub_epi32(_mm_loadu_si128((__m128i*)(e_b + u + up)), vGapE);
+			mE = _mm_cmpgt_epi32(vH, vE);
+			vE = max_epi32(vH, vE);
+			_mm_storeu_si128((__m128i*)(e_b + u), vE);
+			vE = max_epi32(vE, vZero);
+			vD = _mm_add_epi32(_mm_loadu_si128((__m128i*)(hb + u - 1 + up)), _mm_loadu_si128((__m128i*)(p + u - 1)));
+
+			vT = max_epi32(_mm_sub_epi32(vHp, vGapO), _mm_sub_epi32(vFp, vGapE));
+			vF = max_epi32(vE, vD);
+			vF = _mm_or_si128(_mm_slli_si128(_mm_sub_epi32(vF, vGapO), 4), _mm_srli_si128(vT, 12));
+			vF = max_epi32(vF, _mm_sub_epi32(_mm_or_si128(_mm_slli_si128(vF, 4), vMin1), vGapE));
+			vF = max_epi32(vF, _mm_sub_epi32(_mm_or_si128(_mm_slli_si128(vF, 8), vMin2), vGapE2));
+
+			vT = max_epi32(vF, vZero);
+			vGap = max_epi32(vE, vT);
+			mGap = _mm_packs_epi32(_mm_cmpgt_epi32(vGap, vD), _mm_cmpgt_epi32(vE, vT));
+			vH = max_epi32(vGap, vD);
+			vT = _mm_sub_epi32(_mm_or_si128(_mm_slli_si128(vH, 4), _mm_srli_si128(vHp, 12)), vGapO);
+			mF = _mm_cmpgt_epi32(vT, _mm_sub_epi32(_mm_or_si128(_mm_slli_si128(vF, 4), _mm_srli_si128(vFp, 12)), vGapE));
+			_mm_storeu_si128((__m128i*)(hc + u), vH);
+			direction_line[k] = _mm_movemask_epi8(_mm_packs_epi16(mGap, _mm_packs_epi32(mE, mF)));
+			vMax = max_epi32(vMax, _mm_and_si128(vH, _mm_cmpgt_epi32(_mm_set1_epi32(l - u + 1), vLane)));
+			vHp = vH;
+			vFp = vF;
+		}
+		h_t = *h_b; *h_b = *h_c; *h_c = h_t;
+	}
+	max4(max, vMax);
+	return max;
+}
+
+/* The same recurrence and traceback as banded_sw, with band_word, or band_dword when the scores overflow 16 bits. 
+   Its buffers are taken from ws. Return 0 on a trace back error or when the memory cannot be allocated. */
+static cigar* banded_sse2 (const int8_t* ref,
+						   const int8_t* read, 
+						   int32_t refLen, 
+						   int32_t readLen,
+						   int32_t score,
+						   const uint32_t weight_gapO,  /* will be used as - */
+						   const uint32_t weight_gapE,  /* will be used as - */
+						   int32_t band_width,
+						   int32_t band_max,	/* the band holds the best path at this width */
+						   const int8_t* mat,	/* pointer to the weight matrix */
+						   int32_t n,
+						   s_workspace* ws) {	
+
+	uint32_t *c = (uint32_t*)ws_get(ws, WS_CIGAR, 16 * sizeof(uint32_t)), *c1, *direction = 0, d;
+	int32_t i, j, k, u, e, f, temp, s = 16, l, max = 0, segs = 0, s1 = 0, stride = refLen + 8;
+	int32_t rows = readLen, blocks = 1, block, word = 1;	// rows of direction bits per checkpoint; word: 16-bit scores
+	int16_t* profile = (int16_t*)ws_get(ws, WS_BAND_PROFILE, n * stride * sizeof(int16_t));
+	int32_t* profile32 = 0;
+	void *h_b = 0, *h_c = 0, *e_b = 0;	// room for 32-bit scores
+	char* checks = 0;
+	cigar* result;
+
+	if (UNLIKELY(c == 0 || profile == 0)) return 0;
+
+	/* Substitution scores of each residue along the reference, so that a row of the band is one load. */
+	for (k = 0; LIKELY(k < n); ++k) {
+		for (j = 0; LIKELY(j < refLen); ++j) profile[k * stride + j] = mat[ref[j] * n + k];
+		for (; j < stride; ++j) profile[k * stride + j] = 0;
+	}
+
+	for (;;) {
+		segs = (band_width * 2 + 8) / 8;
+		s1 = segs * 8 + 2;
+		h_b = ws_get(ws, WS_BAND_H_B, s1 * sizeof(int32_t));
+		h_c = ws_get(ws, WS_BAND_H_C, s1 * sizeof(int32_t));
+		e_b = ws_get(ws, WS_BAND_E_B, s1 * sizeof(int32_t));
+		if ((size_t)segs * readLen * sizeof(uint32_t) > SSW_BAND_MEM) {
+			/* Half of the memory for the direction bits of a block, but at least as many rows as blocks scaled 
+			   by the size of a checkpoint (two rows of s1) over that of a row of direction bits. */
+			rows = SSW_BAND_MEM / 2 / (segs * sizeof(uint32_t));
+			k = (int32_t)isqrt((int64_t)readLen * s1 * 2 / segs);
+			rows = rows > k ? rows : k;
+			rows = rows < readLen ? (rows > 0 ? rows : 1) : readLen;
+		} else rows = readLen;
+		blocks = (readLen + rows - 1) / rows;
+		direction = (uint32_t*)ws_get(ws, WS_BAND_DIR, (size_t)segs * rows * sizeof(uint32_t));
+		if (blocks > 1) checks = (char*)ws_get(ws, WS_BAND_CHECKS, (size_t)blocks * s1 * 2 * sizeof(int32_t));
+		if (UNLIKELY(h_b == 0 || h_c == 0 || e_b == 0 || direction == 0 || (blocks > 1 && checks == 0))) return 0;
+		memset(h_b, 0, s1 * sizeof(int32_t));
+		memset(e_b, 0, s1 * sizeof(int32_t));	// row 0 opens and extends from 0, as in banded_sw
+		for (block = 0, max = 0; block < blocks; ++block) {
+			int32_t m, i1 = (block + 1) * rows < readLen ? (block + 1) * rows : readLen;
+			if (blocks > 1) {
+				memcpy(checks + (size_t)block * s1 * 2 * sizeof(int32_t), h_b, s1 * sizeof(int32_t));
+				memcpy(checks + ((size_t)block * 2 + 1) * s1 * sizeof(int32_t), e_b, s1 * sizeof(int32_t));
+			}
+			if (word) m = band_word(read, block * rows, i1, profile, stride, refLen, band_width, weight_gapO, weight_gapE, &h_b, &h_c, (int16_t*)e_b, direction, segs);
+			else m = band_dword(read, block * rows, i1, profile32, stride, refLen, band_width, weight_gapO, weight_gapE, &h_b, &h_c, (int32_t*)e_b, direction, segs);
+			max = max > m ? max : m;
+		}
+		if (UNLIKELY(word && max == 32767)) {	// saturated: redo the band with 32-bit scores
+			word = 0;
+			profile32 = (int32_t*)ws_get(ws, WS_BAND_PROFILE32, n * stride * sizeof(int32_t));
+			if (UNLIKELY(profile32 == 0)) return 0;
+			for (k = 0; k < n * stride; ++k) profile32[k] = profile[k];
+			continue;
+		}
+		if (LIKELY(max >= score) || band_width >= refLen + readLen) break;	// wider bands give the same scores
+		band_width = band_next(band_width, band_max);
+	}
+	block = blocks - 1;	// the direction bits of the last block are still there
+
+	// trace back
+	i = readLen - 1;
+	j = refLen - 1;
+	e = 0;	// Count the number of M, D or I.
+	l = 0;	// record length of current cigar
+	f = max = 0; // M
+	temp = 2;	// h
+	while (LIKELY(i > 0)) {
+		int32_t x = i > band_width ? i - band_width : 0, end = i + band_width < refLen ? i + band_width : refLen - 1, b;
+		u = j - x;
+		if (UNLIKELY(u < 0 || j > end)) {
+			fprintf(stderr, "Trace back error: out of the band.\n");
+			return 0;
+		}
+		if (i < block * rows) {	// recompute the block of row i from its checkpoint
+			int32_t i1;
+			block = i / rows;
+			i1 = (block + 1) * rows;
+			memcpy(h_b, checks + (size_t)block * s1 * 2 * sizeof(int32_t), s1 * sizeof(int32_t));
+			memcpy(e_b, checks + ((size_t)block * 2 + 1) * s1 * sizeof(int32_t), s1 * sizeof(int32_t));
+			if (word) band_word(read, block * rows, i1, profile, stride, refLen, band_width, weight_gapO, weight_gapE, &h_b, &h_c, (int16_t*)e_b, direction, segs);
+			else band_dword(read, block * rows, i1, profile32, stride, refLen, band_width, weight_gapO, weight_gapE, &h_b, &h_c, (int32_t*)e_b, direction, segs);
+		}
+		b = word ? (u & 7) : (u & 3) + (u & 4) * 4;	// bit of the cell in its direction word
+		d = direction[(size_t)segs * (i - block * rows) + (u >> 3)] >> b;
+		b = word ? 8 : 4;	// distance between the masks
+		if (temp == 2 && (d & 1) == 0) {	// diagonal
+			--i;
+			--j;
+			f = 0;	// M
+		} else if (temp == 0 || (temp == 2 && (d >> b & 1))) {
+			--i;
+			temp = (d >> b * 2 & 1) ? 2 : 0;
+			f = 1;	// I
+		} else {
+			--j;
+			temp = (d >> b * 3 & 1) ? 2 : 1;
+			f = 2;	// D
+		}
+		if (f == max) ++e;
+		else {
+			++l;
+			while (l >= s) {
+				++s;
+				kroundup32(s);
+				c = (uint32_t*)ws_get(ws, WS_CIGAR, s * sizeof(uint32_t));
+			}
+			c[l - 1] = e<<4|max;
+			max = f;
+			e = 1;
+		}
+	}
+	if (f == 0) {
+		++l;
+		while (l >= s) {
+			++s;
+			kroundup32(s);
+			c = (uint32_t*)ws_get(ws, WS_CIGAR, s * sizeof(uint32_t));
+		}
+		c[l - 1] = (e+1)<<4;
+	}else {
+		l += 2;
+		while (l >= s) {
+			++s;
+			kroundup32(s);
+			c = (uint32_t*)ws_get(ws, WS_CIGAR, s * sizeof(uint32_t));
+		}
+		c[l - 2] = e<<4|f;
+		c[l - 1] = 16;	// 1M
+	}
+
+	// reverse cigar
+	c1 = (uint32_t*)malloc(l * sizeof(uint32_t));
+	for (k = 0; k < l; ++k) c1[k] = c[l - 1 - k];
+	result = (cigar*)malloc(sizeof(cigar));
+	result->seq = c1;
+	result->length = l;
+	return result;
+}
+
+int8_t* seq_reverse(const int8_t* seq, int32_t end)	/* end is 0-based alignment ending position */	
+{									
+	int8_t* reverse = (int8_t*)calloc(end + 1, sizeof(int8_t));	
+	int32_t start = 0;
+	while (LIKELY(start <= end)) {			
+		reverse[start] = seq[end];		
+		reverse[end] = seq[start];		
+		++ start;					
+		-- end;						
+	}								
+	return reverse;					
+}
+		
+/* Return 1 if the 256-bit kernels can run on this CPU. CPUID is only queried on the first call. */
+static int8_t simd_avx2 (void) {
+#ifdef SSW_AVX2
+	static int8_t avx2 = -1;
+	if (UNLIKELY(avx2 < 0)) {
+		__builtin_cpu_init();
+		avx2 = __builtin_cpu_supports("avx2") ? 1 : 0;
+	}
+	return avx2;
+#else
+	return 0;
+#endif
+}
+
+/* Build a query profile in the layout of the kernels selected by ssw_init. */
+/* The profile is written to the WS_PROFILE buffer of ws if ws is not 0, otherwise it is allocated (see profile_free). */
+static __m128i* profile_byte (int8_t avx2, const int8_t* read, const int8_t* mat, int32_t readLen, int32_t n, uint8_t bias, 
+							  s_workspace* ws) {
+#ifdef SSW_AVX2
+	if (avx2) return (__m128i*)qP_byte_avx2(read, mat, readLen, n, bias, ws ? ws_get(ws, WS_PROFILE, n * ((readLen + 31) / 32) * sizeof(__m256i)) : 0);
+#endif
+	return qP_byte(read, mat, readLen, n, bias, ws ? ws_get(ws, WS_PROFILE, n * ((readLen + 15) / 16) * sizeof(__m128i)) : 0);
+}
+
+static __m128i* profile_word (int8_t avx2, const int8_t* read, const int8_t* mat, int32_t readLen, int32_t n, s_workspace* ws) {
+#ifdef SSW_AVX2
+	if (avx2) return (__m128i*)qP_word_avx2(read, mat, readLen, n, ws ? ws_get(ws, WS_PROFILE, n * ((readLen + 15) / 16) * sizeof(__m256i)) : 0);
+#endif
+	return qP_word(read, mat, readLen, n, ws ? ws_get(ws, WS_PROFILE, n * ((readLen + 7) / 8) * sizeof(__m128i)) : 0);
+}
+
+static void profile_free (int8_t avx2, __m128i* vP) {
+#ifdef SSW_AVX2
+	if (avx2) {
+		if (vP) _mm_free(vP);
+		return;
+	}
+#endif
+	free(vP);
+}
+
+/* Return the 16-bit profile of the read (reverse = 0) or of the reversed read (reverse = 1). With score_size 2, ssw_init 
+   leaves them to the first alignment that needs them; the new profile is then published with an atomic compare-and-swap, 
+   so that threads aligning with the same profile can race here: the loser frees its copy. Without SSW_LAZY_WORD, 
+   ssw_init builds them, and the profile is only read here. */
+static __m128i* profile_word_get (const s_profile* prof, int8_t reverse) {
+	__m128i** slot = (__m128i**)(reverse ? &prof->profile_word_rev : &prof->profile_word);
+#ifdef SSW_LAZY_WORD
+	__m128i* vP = __atomic_load_n(slot, __ATOMIC_ACQUIRE), *none = 0;
+	int8_t* read;
+
+	if (LIKELY(vP != 0 || ! prof->lazy)) return vP;
+	if (reverse) {
+		read = seq_reverse(prof->read, prof->readLen - 1);
+		vP = profile_word (prof->avx2, read, prof->mat, prof->readLen, prof->n, 0);
+		free(read);
+	} else vP = profile_word (prof->avx2, prof->read, prof->mat, prof->readLen, prof->n, 0);
+	if (! __atomic_compare_exchange_n(slot, &none, vP, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+		profile_free(prof->avx2, vP);
+		vP = none;	/* the profile of the winner */
+	}
+	return vP;
+#else
+	return *slot;
+#endif
+}
+
+/* Return 1 if the alignments of the read should skip the 8-bit scores: with score_size 2, when a single column may 
+   overflow them (see sw_forward). A read that only may reach 255 still starts with the 8-bit kernel, which hands over 
+   to the 16-bit one at the last safe column, so that its alignments that fit 8 bits are aligned at the 8-bit speed 
+   and with the 8-bit mask of score2. */
+static int8_t word_first (const s_profile* prof) {
+	return prof->lazy && prof->bias + prof->max_mat >= 255;
+}
+
+/* Return the profile rev of the reversed read, made by profile_byte (size = 1) or profile_word (size = 2), with the 
+   scores of its first off residues set to 0 (-bias for 8-bit scores). The H, E and F of these residues then stay 0, so 
+   that the other residues are aligned as if the read started after them: this is the profile of the reversed read 
+   from any ending position, at positions shifted by off, without building a new one. */
+static __m128i* profile_tail (const __m128i* rev, int8_t avx2, int32_t size, int32_t readLen, int32_t n, int32_t off, 
+							  s_workspace* ws) {
+	int32_t bytes = avx2 ? 32 : 16, lanes = bytes / size, segLen = (readLen + lanes - 1) / lanes;
+	int32_t len = segLen * bytes / 16, i, l, k;	/* len: number of __m128i of one residue of the reference */
+	__m128i* vP, *vMask;
+	uint8_t* m;
+
+	if (off == 0) return (__m128i*)rev;
+	vP = (__m128i*) ws_get(ws, WS_PROFILE, n * len * sizeof(__m128i));
+	vMask = (__m128i*) ws_get(ws, WS_TAIL_MASK, len * sizeof(__m128i));
+	m = (uint8_t*)vMask;
+	for (i = 0; i < segLen; ++i) {	/* lane l of segment i holds residue i + l * segLen */
+		for (l = 0; l < lanes; ++l) {
+			for (k = 0; k < size; ++k) *m++ = i + l * segLen < off ? 0 : 0xff;
+		}
+	}
+	for (k = 0; k < n; ++k) {
+		for (i = 0; i < len; ++i) vP[k * len + i] = _mm_and_si128(_mm_load_si128(rev + k * len + i), vMask[i]);
+	}
+	return vP;
+}
+
+static alignment_end* sw_byte (int8_t avx2, const int8_t* ref, int8_t ref_dir, int32_t refLen, int32_t readLen, 
+							   const uint8_t weight_gapO, const uint8_t weight_gapE, __m128i* vProfile, uint8_t terminate, 
+							   uint8_t bias, int32_t maskLen, s_workspace* ws, sw_state* st) {
+#ifdef SSW_AVX2
+	if (avx2) return sw_avx2_byte(ref, ref_dir, refLen, readLen, weight_gapO, weight_gapE, (__m256i*)vProfile, terminate, bias, maskLen, ws, st);
+#endif
+	return sw_sse2_byte(ref, ref_dir, refLen, readLen, weight_gapO, weight_gapE, vProfile, terminate, bias, maskLen, ws, st);
+}
+
+static alignment_end* sw_word (int8_t avx2, const int8_t* ref, int8_t ref_dir, int32_t refLen, int32_t readLen, 
+							   const uint8_t weight_gapO, const uint8_t weight_gapE, __m128i* vProfile, uint16_t terminate, 
+							   int32_t maskLen, s_workspace* ws, sw_state* st) {
+#ifdef SSW_AVX2
+	if (avx2) return sw_avx2_word(ref, ref_dir, refLen, readLen, weight_gapO, weight_gapE, (__m256i*)vProfile, terminate, maskLen, ws, st);
+#endif
+	return sw_sse2_word(ref, ref_dir, refLen, readLen, weight_gapO, weight_gapE, vProfile, terminate, maskLen, ws, st);
+}
+
+static void sw_byte_dual (int8_t avx2, const int8_t* ref, int32_t refLen, int32_t readLen, const uint8_t weight_gapO, 
+						  const uint8_t weight_gapE, __m128i** vProfile, uint8_t bias, s_workspace* ws, sw_state* st) {
+#ifdef SSW_AVX2
+	if (avx2) {
+		sw_avx2_byte_dual(ref, refLen, readLen, weight_gapO, weight_gapE, (__m256i**)vProfile, bias, ws, st);
+		return;
+	}
+#endif
+	sw_sse2_byte_dual(ref, refLen, readLen, weight_gapO, weight_gapE, vProfile, bias, ws, st);
+}
+
+/* Rewrite the column of slot, left in the 8-bit layout of bytes-wide vectors by sw_byte, in the 16-bit layout of 
+   sw_word, residue by residue. The padding rows past the read are kept as far as the 16-bit layout has them. */
+static void widen_column (s_workspace* ws, int32_t slot, int32_t readLen, int32_t bytes) {
+	int32_t segByte = (readLen + bytes - 1) / bytes, lanes = bytes / 2, segWord = (readLen + lanes - 1) / lanes, p;
+	uint8_t* b = (uint8_t*)ws_get(ws, WS_H_LOAD, segByte * bytes);	/* the H column sw_word overwrites first */
+	uint16_t* w;
+
+	memcpy(b, ws->buf[slot], segByte * bytes);
+	w = (uint16_t*)ws_get(ws, slot, segWord * bytes);
+	for (p = 0; p < segWord * lanes; ++p) w[p % segWord * lanes + p / segWord] = b[p % segByte * bytes + p / segByte];
+}
+
+/* Set st and the columns of sw_byte (byte = 1) or sw_word (byte = 0) for the forward pass of prof, see sw_forward. */
+static void forward_init (const s_profile* prof, int32_t refLen, int32_t maskLen, int32_t floor, int32_t xdrop, int32_t byte, 
+						  s_workspace* ws, sw_state* st) {
+	int32_t readLen = prof->readLen, bytes = prof->avx2 ? 32 : 16, lanes = byte ? bytes : bytes / 2;
+	int32_t segLen = (readLen + lanes - 1) / lanes;
+
+	memset(st, 0, sizeof(sw_state));
+	st->end_ref = -1;
+	st->end_read = readLen - 1;
+	st->next = refLen;
+	st->floor = floor;
+	st->xdrop = xdrop;
+	st->max_mat = prof->max_mat;
+	st->stop = byte && prof->lazy ? 255 - prof->bias - prof->max_mat : 0;
+	second_init(&st->second, ws, refLen, maskLen, byte ? maskLen : maskLen - 1, 1);
+	ws_calloc(ws, WS_H_STORE, segLen * bytes);
+	ws_calloc(ws, WS_H_LOAD, segLen * bytes);
+	ws_calloc(ws, WS_E, segLen * bytes);
+	ws_calloc(ws, WS_H_MAX, segLen * bytes);
+}
+
+/* End the forward pass of sw_forward once the 8-bit kernel is done with st: go on with the 16-bit one from st->next, 
+   or from the first column if byte is 0, and write the best and 2nd best alignments to bests. */
+static void forward_end (const s_profile* prof, 
+						 const int8_t* ref, 
+						 int32_t refLen, 
+						 const uint8_t weight_gapO, 
+						 const uint8_t weight_gapE, 
+						 int32_t maskLen, 
+						 int32_t byte, 
+						 s_workspace* ws, 
+						 sw_state* st, 
+						 alignment_end* bests, 
+						 int32_t* word) {
+
+	int32_t readLen = prof->readLen, bytes = prof->avx2 ? 32 : 16;
+
+	if (byte) *word = 0;
+	if (! byte || st->next < refLen) {
+		if (byte) {
+			widen_column(ws, WS_H_STORE, readLen, bytes);
+			widen_column(ws, WS_E, readLen, bytes);
+			widen_column(ws, WS_H_MAX, readLen, bytes);
+			st->vMaxScore = st->vMaxMark = _mm_set1_epi16(st->max);	/* see sw_avx2_byte */
+			st->offset = st->next;
+			st->stop = 0;
+			st->second.hi = maskLen - 1;	/* the mask of the 16-bit kernels */
+		}
+		sw_word(prof->avx2, ref + st->offset, 0, refLen - (int32_t)st->offset, readLen, weight_gapO, weight_gapE, 
+				profile_word_get(prof, 0), -1, maskLen, ws, st);
+		*word = ! prof->profile_byte_rev || st->max + prof->bias >= 255;	// score_size 1: no 8-bit reverse pass
+		if (byte && *word == 0) {	/* no overflow after all: align again with 8 bits only, for their score2 and ref_end2 */
+			forward_init(prof, refLen, maskLen, st->floor, st->xdrop, 1, ws, st);
+			st->stop = 0;
+			sw_byte(prof->avx2, ref, 0, refLen, readLen, weight_gapO, weight_gapE, prof->profile_byte, -1, prof->bias, maskLen, ws, st);
+		}
+	}
+
+	bests[0].score = byte && ! prof->lazy && st->max + prof->bias >= 255 ? 255 : st->max;
+	bests[0].ref = (int32_t)st->end_ref;
+	bests[0].read = st->end_read;
+	second_find(&st->second, bests + 1);
+}
+
+/* The forward pass of align_core, from the first column with the 16-bit kernel if word_first, else with the 8-bit 
+   one. With score_size 2, the 8-bit kernel stops after the first column where the best score reaches 255 - bias - 
+   max_mat, the last one before a column that may overflow; the 16-bit kernel then goes on from its H and E columns, 
+   widened, instead of aligning the whole reference again. If the best score then still fits 8 bits, the reference is 
+   aligned again with the 8-bit kernel alone, so that score2 and ref_end2 are those of the 8-bit mask (this only 
+   happens for best scores in the last max_mat below 255 - bias). Both stop early when the score cannot reach floor 
+   or drops more than xdrop below the best score (see stop_early; 0: never). word is set to 0 if the best score fits 
+   the 8-bit reverse pass, else to 1. */
+static alignment_end* sw_forward (const s_profile* prof, 
+								  const int8_t* ref, 
+								  int32_t refLen, 
+								  const uint8_t weight_gapO, 
+								  const uint8_t weight_gapE, 
+								  int32_t maskLen, 
+								  int32_t floor, 
+								  int32_t xdrop, 
+								  s_workspace* ws, 
+								  int32_t* word) {
+
+	int32_t byte = prof->profile_byte && ! word_first(prof);
+	alignment_end* bests;
+	sw_state st;
+
+	forward_init(prof, refLen, maskLen, floor, xdrop, byte, ws, &st);
+	if (byte) sw_byte(prof->avx2, ref, 0, refLen, prof->readLen, weight_gapO, weight_gapE, prof->profile_byte, -1, prof->bias, maskLen, ws, &st);
+	bests = (alignment_end*) ws_calloc(ws, WS_BESTS, 2 * sizeof(alignment_end));
+	forward_end(prof, ref, refLen, weight_gapO, weight_gapE, maskLen, byte, ws, &st, bests, word);
+	return bests;
+}
+
+/* sw_forward of the 2 profiles prof[0] and prof[1] of reads of the same length against ref, with the bests and word of 
+   prof[s] written to bests[s] and word[s]. Both start in one scan with the 8-bit dual kernel; once one of them stops, 
+   the other goes on alone from where they were, and either ends as sw_forward does, so that the results are those of 
+   sw_forward. Return 0, with nothing done, if the profiles cannot share the 8-bit kernel. */
+static int8_t sw_forward_dual (const s_profile** prof, 
+							   const int8_t* ref, 
+							   int32_t refLen, 
+							   const uint8_t weight_gapO, 
+							   const uint8_t weight_gapE, 
+							   int32_t maskLen, 
+							   int32_t floor, 
+							   int32_t xdrop, 
+							   s_workspace* ws, 
+							   alignment_end (*bests)[2], 
+							   int32_t* word) {
+
+	__m128i* vP[2] = {prof[0]->profile_byte, prof[1]->profile_byte};
+	sw_state st[2];
+	int32_t s, off;
+
+	if (vP[0] == 0 || vP[1] == 0 || prof[0]->readLen != prof[1]->readLen || prof[0]->avx2 != prof[1]->avx2 || 
+		prof[0]->bias != prof[1]->bias || word_first(prof[0]) || word_first(prof[1]) || 
+		(prof[0]->avx2 && weight_gapO <= weight_gapE)) return 0;	/* see profile_sse2 */
+
+	/* The columns of prof[1] go to the WS_DUAL buffers, the second_best ring included. */
+	forward_init(prof[1], refLen, maskLen, floor, xdrop, 1, ws, &st[1]);
+	ws_swap_dual(ws);
+	forward_init(prof[0], refLen, maskLen, floor, xdrop, 1, ws, &st[0]);
+	sw_byte_dual(prof[0]->avx2, ref, refLen, prof[0]->readLen, weight_gapO, weight_gapE, vP, prof[0]->bias, ws, st);
+
+	for (s = 0; s < 2; ++s) {
+		if (s == 1) ws_swap_dual(ws);
+		off = (int32_t)st[s].offset;
+		if (off < refLen) {	/* the scan stopped for the other profile: resume this one as a stream */
+			st[s].next = refLen - off;
+			sw_byte(prof[s]->avx2, ref + off, 0, refLen - off, prof[s]->readLen, weight_gapO, weight_gapE, vP[s], -1, 
+					prof[s]->bias, maskLen, ws, &st[s]);
+			st[s].next += off;
+		}
+		forward_end(prof[s], ref, refLen, weight_gapO, weight_gapE, maskLen, 1, ws, &st[s], bests[s], &word[s]);
+	}
+	return 1;
+}
+
+/* Return prof, or, if its profiles are in the 256-bit layout and weight_gapO <= weight_gapE, a copy of it in sse2 with 
+   the profiles of the 128-bit layout, built in ws. The lazy F loop stops at the first segment where F cannot raise 
+   H - gapO, which bounds the rest of the column only if F drops faster than H: with such gaps, the scores depend on 
+   the striping, and the AVX2 kernels would not give those of the SSE2 ones. */
+static const s_profile* profile_sse2 (const s_profile* prof, const uint8_t weight_gapO, const uint8_t weight_gapE, 
+									  s_profile* sse2, s_workspace* ws) {
+	int32_t readLen = prof->readLen, n = prof->n, i;
+	int8_t* reverse;
+
+	if (LIKELY(! prof->avx2 || weight_gapO > weight_gapE)) return prof;
+	*sse2 = *prof;
+	sse2->avx2 = 0;
+	reverse = (int8_t*)ws_get(ws, WS_READ_REVERSE, readLen);
+	for (i = 0; i < readLen; ++i) reverse[i] = prof->read[readLen - 1 - i];
 	if (prof->profile_byte) {
-		bests = sw_sse2_byte(ref, 0, refLen, readLen, weight_gapO, weight_gapE, prof->profile_byte, -1, prof->bias, maskLen);
-		if (prof->profile_word && bests[0].score == 255) {
-			free(bests);
-			bests = sw_sse2_word(ref, 0, refLen, readLen, weight_gapO, weight_gapE, prof->profile_word, -1, maskLen);
-			word = 1;
-		} else if (bests[0].score == 255) {
-			fprintf(stderr, "Please set 2 to the score_size parameter of the function ssw_init, otherwise the alignment results will be incorrect.\n");
-			return 0;
+		sse2->profile_byte = qP_byte(prof->read, prof->mat, readLen, n, prof->bias, ws_get(ws, WS_SSE2_BYTE, n * ((readLen + 15) / 16) * sizeof(__m128i)));
+		sse2->profile_byte_rev = qP_byte(reverse, prof->mat, readLen, n, prof->bias, ws_get(ws, WS_SSE2_BYTE_REV, n * ((readLen + 15) / 16) * sizeof(__m128i)));
+	}
+	if (prof->profile_word || prof->lazy) {	/* built here even if lazy: profile_word_get then finds them */
+		sse2->profile_word = qP_word(prof->read, prof->mat, readLen, n, ws_get(ws, WS_SSE2_WORD, n * ((readLen + 7) / 8) * sizeof(__m128i)));
+		sse2->profile_word_rev = qP_word(reverse, prof->mat, readLen, n, ws_get(ws, WS_SSE2_WORD_REV, n * ((readLen + 7) / 8) * sizeof(__m128i)));
+	}
+	return sse2;
+}
+
+s_profile* ssw_init (const int8_t* read, const int32_t readLen, const int8_t* mat, const int32_t n, const int8_t score_size) {
+	s_profile* p = (s_profile*)calloc(1, sizeof(struct _profile));
+	int32_t i;
+	p->profile_byte = 0;
+	p->profile_word = 0;
+	p->bias = 0;
+
+	/* Short reads keep the 128-bit kernels: with only a few segments per column, the cross-lane shifts and the wider 
+	   reductions cost more than the extra lanes save. */
+	p->avx2 = readLen >= 128 && simd_avx2();
+	
+	p->lazy = score_size == 2;
+	for (i = 0; i < n*n; i++) if (mat[i] > p->max_mat) p->max_mat = mat[i];
+	if (score_size == 0 || score_size == 2) {
+		/* Find the bias to use in the substitution matrix */
+		int32_t bias = 0;
+		for (i = 0; i < n*n; i++) if (mat[i] < bias) bias = mat[i];
+		bias = abs(bias);
+
+		p->bias = bias;
+		p->profile_byte = profile_byte (p->avx2, read, mat, readLen, n, bias, 0);
+	}
+	if (score_size == 1) p->profile_word = profile_word (p->avx2, read, mat, readLen, n, 0);
+#ifndef SSW_LAZY_WORD
+	if (p->lazy) p->profile_word = profile_word (p->avx2, read, mat, readLen, n, 0);	/* see profile_word_get */
+#endif
+	if (readLen > 0) {	/* built once here rather than at each reverse pass of ssw_align */
+		int8_t* reverse = seq_reverse(read, readLen - 1);
+		if (p->profile_byte) p->profile_byte_rev = profile_byte (p->avx2, reverse, mat, readLen, n, p->bias, 0);
+		if (p->profile_word) p->profile_word_rev = profile_word (p->avx2, reverse, mat, readLen, n, 0);
+		free(reverse);
+	}
+	p->read = read;
+	p->mat = mat;
+	p->readLen = readLen;
+	p->n = n;
+	return p;
+}
+
+void init_destroy (s_profile* p) {
+	profile_free(p->avx2, p->profile_byte);
+	profile_free(p->avx2, p->profile_word);
+	profile_free(p->avx2, p->profile_byte_rev);
+	profile_free(p->avx2, p->profile_word_rev);
+	free(p);
+}
+
+/* Generate the cigar of the best alignment in r, whose beginning and ending positions are set. Return 0 on error. */
+static int8_t align_cigar (s_align2* r, 
+						   const int8_t* ref, 
+						   const int8_t* read, 
+						   const uint8_t weight_gapO, 
+						   const uint8_t weight_gapE, 
+						   const int8_t* mat, 
+						   int32_t n,
+						   s_workspace* ws) {
+	int32_t refLen = r->ref_end1 - r->ref_begin1 + 1;
+	int32_t readLen = r->read_end1 - r->read_begin1 + 1;
+	int32_t band_width = abs(refLen - readLen) + 1, band_max, i;
+	int64_t gap = 0;
+	cigar* path = 0;
+
+	/* Widen the band at most up to the width the best path can reach: a path of score1 leaves at most 
+	   max_match * min(refLen, readLen) - score1 for the gaps, and it has to get back to the ending diagonal. */
+	for (i = 0; i < n * n; ++i) gap = gap > mat[i] ? gap : mat[i];
+	gap = gap * (refLen < readLen ? refLen : readLen) - r->score1 - weight_gapO;
+	gap = gap < 0 || weight_gapE == 0 ? 0 : gap / weight_gapE + 1;
+	gap = (gap + band_width - 1) / 2;
+	band_max = gap > band_width ? (gap < refLen + readLen ? gap : refLen + readLen) : band_width;
+
+	/* The vector kernels need gapO >= gapE. */
+	if (weight_gapO >= weight_gapE) path = banded_sse2(ref + r->ref_begin1, read + r->read_begin1, refLen, readLen, r->score1, weight_gapO, weight_gapE, band_width, band_max, mat, n, ws);
+	else path = banded_sw(ref + r->ref_begin1, read + r->read_begin1, refLen, readLen, r->score1, weight_gapO, weight_gapE, band_width, band_max, mat, n);
+	if (path == 0) return 0;
+	r->cigar = path->seq;
+	r->cigarLen = path->length;
+	free(path);
+	return 1;
+}
+
+/* Return 1 if the cigar of r is wanted, according to flag, filters and filterd (see ssw_align). */
+static int8_t want_cigar (const s_align2* r, uint8_t flag, int32_t filters, int32_t filterd) {
+	return ! ((7&flag) == 0 || ((2&flag) != 0 && r->score1 < filters) || ((4&flag) != 0 && (r->ref_end1 - r->ref_begin1 > filterd || r->read_end1 - r->read_begin1 > filterd)));
+}
+
+/* Bit b of the direction bits of cell (i, k), as recorded by sw_sse2_byte_trace (lanes = 16) or sw_sse2_word_trace 
+   (lanes = 8). */
+static inline int32_t trace_bit (const uint16_t* dir, int32_t lanes, int32_t segLen, int32_t i, int32_t k, int32_t b) {
+	const uint16_t* d = dir + ((size_t)i * segLen + k % segLen) * (lanes / 4);
+	int32_t l = k / segLen;
+	return lanes == 16 ? d[b] >> l & 1 : d[b >> 1] >> ((b & 1) * 8 + l) & 1;
+}
+
+/* Walk the direction bits back from the ending position of the best alignment in r, and set its beginning positions 
+   and cigar. Return 0 if the path does not add up to the alignment score. */
+static int8_t trace_back (s_align2* r, 
+						  const uint16_t* dir, 
+						  int32_t lanes, 
+						  int32_t segLen, 
+						  const int8_t* ref, 
+						  const int8_t* read, 
+						  const uint8_t weight_gapO, 
+						  const uint8_t weight_gapE, 
+						  const int8_t* mat, 
+						  int32_t n) {
+	int32_t i = r->ref_end1, k = r->read_end1, state = 0, score = 0, op = 0, len = 0, l = 0, s, e;
+	uint32_t* c = (uint32_t*)malloc((i + k + 2) * sizeof(uint32_t));	// the path has at most one operation per row and column
+
+	while (LIKELY(1)) {
+		int32_t next;	// 0: M; 1: I; 2: D
+		if (state == 0) {
+			int32_t h = i < 0 || k < 0 ? 3 : trace_bit(dir, lanes, segLen, i, k, 0) | trace_bit(dir, lanes, segLen, i, k, 1) << 1;
+			if (h == 3) break;	// H is 0: the alignment begins at the previous cell
+			if (h != 0) {
+				state = h;	// 1: E; 2: F
+				continue;
+			}
+			score += mat[ref[i] * n + read[k]];
+			next = 0;
+		} else if (state == 1) {
+			int32_t ext;
+			if (i == 0) break;
+			ext = trace_bit(dir, lanes, segLen, i - 1, k, 2);
+			score -= ext ? weight_gapE : weight_gapO;
+			state = ext ? 1 : 0;
+			next = 2;
+		} else {
+			int32_t ext;
+			if (k == 0) break;
+			ext = trace_bit(dir, lanes, segLen, i, k, 3);
+			score -= ext ? weight_gapE : weight_gapO;
+			state = ext ? 2 : 0;
+			next = 1;
 		}
-	}else if (prof->profile_word) {
-		bests = sw_sse2_word(ref, 0, refLen, readLen, weight_gapO, weight_gapE, prof->profile_word, -1, maskLen);
-		word = 1;
-	}else {
+		if (next == op && len > 0) ++len;
+		else {
+			if (len > 0) c[l++] = len<<4|op;
+			op = next;
+			len = 1;
+		}
+		if (next != 1) --i;
+		if (next != 2) --k;
+	}
+	if (len > 0) c[l++] = len<<4|op;
+
+	if (state != 0 || op != 0 || score != r->score1) {
+		free(c);
+		return 0;
+	}
+
+	// reverse cigar
+	s = 0;
+	e = l - 1;
+	while (LIKELY(s < e)) {
+		uint32_t t = c[s];
+		c[s] = c[e];
+		c[e] = t;
+		++ s;
+		-- e;
+	}
+	r->ref_begin1 = i + 1;
+	r->read_begin1 = k + 1;
+	r->cigar = c;
+	r->cigarLen = l;
+	return 1;
+}
+
+/* Above this many bytes of direction bits, align_trace leaves the alignment to the reverse pass and banded_sw. */
+#define TRACE_MAX 67108864
+
+/* Fill r with the alignment of prof against ref, finding the beginning positions and cigar from the direction bits 
+   of the forward pass. Return 0 if this cannot be done: too large a matrix or a score that overflows 16 bits. */
+static int8_t align_trace (s_align2* r,
+						   const s_profile* prof, 
+						   const int8_t* ref, 
+						   int32_t refLen, 
+						   const uint8_t weight_gapO, 
+						   const uint8_t weight_gapE, 
+						   const int32_t maskLen,
+						   s_workspace* ws) {
+
+	alignment_end* bests = 0;
+	__m128i* vP;
+	uint16_t* dir;
+	int32_t readLen = prof->readLen, lanes = 16, segLen = (readLen + 15) / 16;
+
+	// The byte kernel needs at least as many bits as the word kernel.
+	if ((int64_t)refLen * segLen * 8 > TRACE_MAX) return 0;
+	dir = (uint16_t*)ws_get(ws, WS_DIR, (size_t)refLen * segLen * 8);
+
+	// The trace kernels are 128-bit only, so the profiles in the 256-bit layout are rebuilt.
+	if (prof->profile_byte && ! word_first(prof)) {
+		vP = prof->avx2 ? qP_byte(prof->read, prof->mat, readLen, prof->n, prof->bias, ws_get(ws, WS_PROFILE, prof->n * segLen * sizeof(__m128i))) : prof->profile_byte;
+		bests = sw_sse2_byte_trace(ref, refLen, readLen, weight_gapO, weight_gapE, vP, prof->bias, maskLen, dir, ws);
+		if (bests[0].score == 255) bests = 0;
+	}
+	if (bests == 0 && (prof->profile_word || prof->lazy)) {
+		lanes = 8;
+		segLen = (readLen + 7) / 8;
+		vP = prof->avx2 ? qP_word(prof->read, prof->mat, readLen, prof->n, ws_get(ws, WS_PROFILE, prof->n * segLen * sizeof(__m128i))) : profile_word_get(prof, 0);
+		bests = sw_sse2_word_trace(ref, refLen, readLen, weight_gapO, weight_gapE, vP, maskLen, dir, ws);
+		if (bests[0].score == 32767) bests = 0;
+	}
+	if (bests == 0) return 0;
+
+	r->score1 = bests[0].score;
+	r->ref_end1 = bests[0].ref;
+	r->read_end1 = bests[0].read;
+	if (maskLen >= 15) {
+		r->score2 = bests[1].score;
+		r->ref_end2 = bests[1].ref;
+	} else {
+		r->score2 = 0;
+		r->ref_end2 = -1;
+	}
+	return r->score1 == 0 || trace_back(r, dir, lanes, segLen, ref, prof->read, weight_gapO, weight_gapE, prof->mat, prof->n);	// no alignment: nothing to trace
+}
+
+/* Fill r with the alignment of prof against ref; shared by ssw_align and ssw_align2. Return 0 on error. */
+/* Return the most residues of the reference that a local alignment of q read residues scoring score can span, -1 if 
+   there is no such bound. The q residues score at most q * max_mat, and each deleted reference residue costs at least 
+   min(weight_gapO, weight_gapE) out of what they score above score. */
+static int64_t align_span (int32_t q, int32_t score, int32_t max_mat, uint8_t weight_gapO, uint8_t weight_gapE) {
+	int32_t gap = weight_gapO < weight_gapE ? weight_gapO : weight_gapE;
+	int64_t slack = (int64_t)q * max_mat - score;
+	if (gap == 0) return -1;
+	return q + (slack > 0 ? slack / gap : 0);
+}
+
+static int8_t align_core (s_align2* r,
+						  const s_profile* prof, 
+						  const int8_t* ref, 
+						  int32_t refLen, 
+						  const uint8_t weight_gapO, 
+						  const uint8_t weight_gapE, 
+						  uint8_t flag,	//  (from high to low) bit 4: trace the beginning position and cigar back in the forward pass; 5: return the best alignment beginning position; 6: if (ref_end1 - ref_begin1 <= filterd) && (read_end1 - read_begin1 <= filterd), return cigar; 7: if max score >= filters, return cigar; 8: always return cigar; if 6 & 7 are both setted, only return cigar when both filter fulfilled
+						  const int32_t filters,
+						  const int32_t filterd,
+						  const int32_t maskLen,
+						  alignment_end* bests,	// 0, or the result of the forward pass already done by sw_forward_dual
+						  int32_t word,	// with bests: the word of sw_forward_dual
+						  s_workspace* ws) {
+
+	alignment_end* bests_reverse = 0;
+	__m128i* vP = 0;
+	s_profile sse2;
+	int32_t readLen = prof->readLen;	// word: 0: byte kernel; 1: word kernel; 2: dword kernel
+	int32_t i, off, begin;
+	int64_t span;
+	int8_t* read_reverse = 0;
+	int8_t trace = (flag & 0x10) != 0;
+	int32_t floor = flag & 0x20 && filters > 0 ? filters : 0;	// abandon the alignment once it cannot reach filters
+	int32_t xdrop = flag & 0x40 && filterd > 0 ? filterd : 0;	// stop the scan once the scores drop filterd below the best
+	flag &= 0x0f;
+	r->ref_begin1 = -1;
+	r->read_begin1 = -1;
+	r->cigar = 0;
+	r->cigarLen = 0;
+	if (maskLen < 15) {
+		fprintf(stderr, "When maskLen < 15, the function ssw_align doesn't return 2nd best alignment information.\n");
+	}
+	prof = profile_sse2(prof, weight_gapO, weight_gapE, &sse2, ws);
+
+	// The beginning position is wanted: find it, and the cigar, in one pass if the direction bits can be recorded.
+	if (trace && flag != 0 && bests == 0 && align_trace(r, prof, ref, refLen, weight_gapO, weight_gapE, maskLen, ws)) {
+		if (flag == 2 && r->score1 < filters) {
+			r->ref_begin1 = -1;
+			r->read_begin1 = -1;
+		}
+		if (! want_cigar(r, flag, filters, filterd)) {
+			free(r->cigar);
+			r->cigar = 0;
+			r->cigarLen = 0;
+		}
+		goto end;
+	}
+
+	// Find the alignment scores and ending positions
+	if (prof->profile_byte == 0 && prof->profile_word == 0 && ! prof->lazy) {
 		fprintf(stderr, "Please call the function ssw_init before ssw_align.\n");
 		return 0;
 	}
+	if (bests == 0) bests = sw_forward(prof, ref, refLen, weight_gapO, weight_gapE, maskLen, floor, xdrop, ws, &word);
+	if (word == 0 && bests[0].score == 255) {
+		fprintf(stderr, "Please set 2 to the score_size parameter of the function ssw_init, otherwise the alignment results will be incorrect.\n");
+		return 0;
+	}
+	if (word == 1 && bests[0].score == 32767) {	// The 16-bit kernel saturated; its profile is too short-lived to keep.
+		vP = qP_dword(prof->read, prof->mat, readLen, prof->n, ws_get(ws, WS_PROFILE, prof->n * ((readLen + 3) / 4) * sizeof(__m128i)));
+		bests = sw_sse2_dword(ref, 0, refLen, readLen, weight_gapO, weight_gapE, vP, -1, maskLen, ws, 0);
+		word = 2;
+	}
 	r->score1 = bests[0].score;
 	r->ref_end1 = bests[0].ref;
 	r->read_end1 = bests[0].read;
@@ -820,42 +3863,632 @@ s_align* ssw_align (const s_profile* prof,
 		r->score2 = 0;
 		r->ref_end2 = -1;
 	}
-	free(bests);
-	if (flag == 0 || (flag == 2 && r->score1 < filters)) goto end;
+	if (flag == 0 || (flag == 2 && r->score1 < filters) || r->score1 < floor) goto end;
 
 	// Find the beginning position of the best alignment.
-	read_reverse = seq_reverse(prof->read, r->read_end1);
+	// The reversed read from read_end1 is the reversed read without its first off residues.
+	off = readLen - 1 - r->read_end1;
+	span = align_span(r->read_end1 + 1, r->score1, prof->max_mat, weight_gapO, weight_gapE);
+	begin = span >= 0 && span < r->ref_end1 + 1 ? r->ref_end1 + 1 - (int32_t)span : 0;
 	if (word == 0) {
-		vP = qP_byte(read_reverse, prof->mat, r->read_end1 + 1, prof->n, prof->bias);
-		bests_reverse = sw_sse2_byte(ref, 1, r->ref_end1 + 1, r->read_end1 + 1, weight_gapO, weight_gapE, vP, r->score1, prof->bias, maskLen);
-	} else {
-		vP = qP_word(read_reverse, prof->mat, r->read_end1 + 1, prof->n);
-		bests_reverse = sw_sse2_word(ref, 1, r->ref_end1 + 1, r->read_end1 + 1, weight_gapO, weight_gapE, vP, r->score1, maskLen);
+		vP = profile_tail(prof->profile_byte_rev, prof->avx2, 1, readLen, prof->n, off, ws);
+		bests_reverse = sw_byte(prof->avx2, ref + begin, 1, r->ref_end1 + 1 - begin, readLen, weight_gapO, weight_gapE, vP, r->score1, prof->bias, maskLen, ws, 0);
+	} else if (word == 1) {
+		vP = profile_tail(profile_word_get(prof, 1), prof->avx2, 2, readLen, prof->n, off, ws);
+		bests_reverse = sw_word(prof->avx2, ref + begin, 1, r->ref_end1 + 1 - begin, readLen, weight_gapO, weight_gapE, vP, r->score1, maskLen, ws, 0);
+	} else {	// rare enough that the 32-bit profile is not kept
+		off = 0;
+		read_reverse = (int8_t*)ws_get(ws, WS_READ_REVERSE, r->read_end1 + 1);
+		for (i = 0; i <= r->read_end1; ++i) read_reverse[i] = prof->read[r->read_end1 - i];
+		vP = qP_dword(read_reverse, prof->mat, r->read_end1 + 1, prof->n, ws_get(ws, WS_PROFILE, prof->n * ((r->read_end1 + 4) / 4) * sizeof(__m128i)));
+		bests_reverse = sw_sse2_dword(ref + begin, 1, r->ref_end1 + 1 - begin, r->read_end1 + 1, weight_gapO, weight_gapE, vP, r->score1, maskLen, ws, 0);
 	}
-	free(vP);
-	free(read_reverse);
-	r->ref_begin1 = bests_reverse[0].ref;
-	r->read_begin1 = r->read_end1 - bests_reverse[0].read;
-	free(bests_reverse);
-	if ((7&flag) == 0 || ((2&flag) != 0 && r->score1 < filters) || ((4&flag) != 0 && (r->ref_end1 - r->ref_begin1 > filterd || r->read_end1 - r->read_begin1 > filterd))) goto end;
+	r->ref_begin1 = begin + bests_reverse[0].ref;
+	r->read_begin1 = r->read_end1 - (bests_reverse[0].read - off);
+	if (! want_cigar(r, flag, filters, filterd)) goto end;
 
 	// Generate cigar.
-	refLen = r->ref_end1 - r->ref_begin1 + 1;
-	readLen = r->read_end1 - r->read_begin1 + 1;
-	band_width = abs(refLen - readLen) + 1;
-	path = banded_sw(ref + r->ref_begin1, prof->read + r->read_begin1, refLen, readLen, r->score1, weight_gapO, weight_gapE, band_width, prof->mat, prof->n);
-	if (path == 0) r = 0;
-	else {
-		r->cigar = path->seq;
-		r->cigarLen = path->length;
-		free(path);
-	}
+	return align_cigar(r, ref, prof->read, weight_gapO, weight_gapE, prof->mat, prof->n, ws);
 	
 end: 
+	return 1;
+}
+
+/* Move the result in a into a new s_align, capping the scores at 65535. */
+static s_align* align_short (const s_align2* a) {
+	s_align* r = (s_align*)calloc(1, sizeof(s_align));
+	r->score1 = a->score1 > 65535 ? 65535 : a->score1;
+	r->score2 = a->score2 > 65535 ? 65535 : a->score2;
+	r->ref_begin1 = a->ref_begin1;
+	r->ref_end1 = a->ref_end1;
+	r->read_begin1 = a->read_begin1;
+	r->read_end1 = a->read_end1;
+	r->ref_end2 = a->ref_end2;
+	r->cigar = a->cigar;
+	r->cigarLen = a->cigarLen;
+	return r;
+}
+
+s_align* ssw_align (const s_profile* prof, 
+					const int8_t* ref, 
+				  	int32_t refLen, 
+				  	const uint8_t weight_gapO, 
+				  	const uint8_t weight_gapE, 
+					const uint8_t flag,
+					const uint16_t filters,
+					const int32_t filterd,
+					const int32_t maskLen) {
+
+	s_workspace* ws = workspace_init();
+	s_align* r = ssw_align_ws(ws, prof, ref, refLen, weight_gapO, weight_gapE, flag, filters, filterd, maskLen);
+	workspace_destroy(ws);
+	return r;
+}
+
+s_align2* ssw_align2 (const s_profile* prof, 
+					  const int8_t* ref, 
+					  int32_t refLen, 
+					  const uint8_t weight_gapO, 
+					  const uint8_t weight_gapE, 
+					  const uint8_t flag,
+					  const int32_t filters,
+					  const int32_t filterd,
+					  const int32_t maskLen) {
+
+	s_workspace* ws = workspace_init();
+	s_align2* r = ssw_align2_ws(ws, prof, ref, refLen, weight_gapO, weight_gapE, flag, filters, filterd, maskLen);
+	workspace_destroy(ws);
+	return r;
+}
+
+s_align* ssw_align_ws (s_workspace* ws, 
+					   const s_profile* prof, 
+					   const int8_t* ref, 
+					   int32_t refLen, 
+					   const uint8_t weight_gapO, 
+					   const uint8_t weight_gapE, 
+					   const uint8_t flag,
+					   const uint16_t filters,
+					   const int32_t filterd,
+					   const int32_t maskLen) {
+
+	s_align2 a;
+	if (! align_core(&a, prof, ref, refLen, weight_gapO, weight_gapE, flag, filters, filterd, maskLen, 0, 0, ws)) return 0;
+	return align_short(&a);
+}
+
+s_align2* ssw_align2_ws (s_workspace* ws, 
+						 const s_profile* prof, 
+						 const int8_t* ref, 
+						 int32_t refLen, 
+						 const uint8_t weight_gapO, 
+						 const uint8_t weight_gapE, 
+						 const uint8_t flag,
+						 const int32_t filters,
+						 const int32_t filterd,
+						 const int32_t maskLen) {
+
+	s_align2* r = (s_align2*)calloc(1, sizeof(s_align2));
+	if (! align_core(r, prof, ref, refLen, weight_gapO, weight_gapE, flag, filters, filterd, maskLen, 0, 0, ws)) {
+		free(r);
+		return 0;
+	}
+	return r;
+}
+
+s_align2* ssw_align2_dual (s_workspace* ws, 
+						   const s_profile* prof, 
+						   const s_profile* prof_rc, 
+						   const int8_t* ref, 
+						   int32_t refLen, 
+						   const uint8_t weight_gapO, 
+						   const uint8_t weight_gapE, 
+						   const uint8_t flag,
+						   const int32_t filters,
+						   const int32_t filterd,
+						   const int32_t maskLen,
+						   int8_t* strand,
+						   int32_t* scores) {
+
+	const s_profile* p[2] = {prof, prof_rc};
+	alignment_end bests[2][2];
+	s_align2 a[2], *r;
+	int32_t word[2], s, n = prof_rc ? 2 : 1;
+	int32_t floor = flag & 0x20 && filters > 0 ? filters : 0, xdrop = flag & 0x40 && filterd > 0 ? filterd : 0;
+	int8_t trace = (flag & 0x10) && (flag & 0x0f);
+	int8_t dual = prof_rc && sw_forward_dual(p, ref, refLen, weight_gapO, weight_gapE, maskLen, floor, xdrop, ws, bests, word);
+
+	scores[1] = 0;
+	if (dual && bests[0][0].score != 32767 && bests[1][0].score != 32767) {	// only the better strand is aligned further
+		scores[0] = bests[0][0].score;
+		scores[1] = bests[1][0].score;
+		s = scores[1] > scores[0];
+		if (! align_core(a + s, p[s], ref, refLen, weight_gapO, weight_gapE, flag, filters, filterd, maskLen, trace ? 0 : bests[s], word[s], ws)) return 0;
+	} else {	// no dual scan, or the 16-bit kernel saturated: the scores to compare are those of the 32-bit one
+		for (s = 0; s < n; ++s) {
+			if (! align_core(a + s, p[s], ref, refLen, weight_gapO, weight_gapE, flag, filters, filterd, maskLen, dual ? bests[s] : 0, dual ? word[s] : 0, ws)) {
+				if (s) free(a[0].cigar);
+				return 0;
+			}
+			scores[s] = a[s].score1;
+		}
+		s = n == 2 && a[1].score1 > a[0].score1;
+		if (n == 2) free(a[1 - s].cigar);
+	}
+	*strand = s;
+	r = (s_align2*)malloc(sizeof(s_align2));
+	*r = a[s];
 	return r;
 }
 
+struct _stream {
+	s_workspace* ws;
+	__m128i* profile;	/* query profile of the SSE2 kernel */
+	sw_state st;
+	int32_t readLen, maskLen;
+	uint8_t weight_gapO, weight_gapE, bias;
+	int8_t word;	/* 0: 8-bit, 1: 16-bit, 2: 32-bit scores */
+};
+
+s_stream* ssw_stream_init (const s_profile* prof, 
+						   const uint8_t weight_gapO, 
+						   const uint8_t weight_gapE, 
+						   const int32_t maskLen) {
+
+	s_stream* s = (s_stream*)calloc(1, sizeof(s_stream));
+	int32_t readLen = prof->readLen, max_mat = 0, bias = 0, i, lanes;
+	int64_t bound;
+
+	for (i = 0; i < prof->n * prof->n; ++i) {
+		if (prof->mat[i] > max_mat) max_mat = prof->mat[i];
+		if (prof->mat[i] < bias) bias = prof->mat[i];
+	}
+	/* No local alignment scores more than max_mat per read residue. A stream cannot be aligned again with wider scores 
+	   when they overflow, so take the narrowest ones that cannot. */
+	bound = (int64_t)max_mat * readLen;
+	s->word = bound - bias < 255 ? 0 : bound < 32767 ? 1 : 2;
+	s->bias = -bias;
+	s->readLen = readLen;
+	s->maskLen = maskLen;
+	s->weight_gapO = weight_gapO;
+	s->weight_gapE = weight_gapE;
+	s->ws = workspace_init();
+	if (s->word == 0) s->profile = qP_byte(prof->read, prof->mat, readLen, prof->n, s->bias, 0);
+	else if (s->word == 1) s->profile = qP_word(prof->read, prof->mat, readLen, prof->n, 0);
+	else s->profile = qP_dword(prof->read, prof->mat, readLen, prof->n, 0);
+
+	/* The columns before the first chunk are all 0. */
+	lanes = s->word == 0 ? 16 : s->word == 1 ? 8 : 4;
+	ws_calloc(s->ws, WS_H_STORE, (readLen + lanes - 1) / lanes * sizeof(__m128i));
+	ws_calloc(s->ws, WS_H_LOAD, (readLen + lanes - 1) / lanes * sizeof(__m128i));
+	ws_calloc(s->ws, WS_E, (readLen + lanes - 1) / lanes * sizeof(__m128i));
+	ws_calloc(s->ws, WS_H_MAX, (readLen + lanes - 1) / lanes * sizeof(__m128i));
+	s->st.end_ref = -1;
+	s->st.end_read = readLen - 1;
+	second_init(&s->st.second, s->ws, INT32_MAX, maskLen, s->word ? maskLen - 1 : maskLen, 1);
+	return s;
+}
+
+void ssw_stream_feed (s_stream* s, const int8_t* ref, int32_t refLen) {
+	if (refLen <= 0) return;
+	if (s->word == 0) sw_sse2_byte(ref, 0, refLen, s->readLen, s->weight_gapO, s->weight_gapE, s->profile, -1, s->bias, s->maskLen, 
+								   s->ws, &s->st);
+	else if (s->word == 1) sw_sse2_word(ref, 0, refLen, s->readLen, s->weight_gapO, s->weight_gapE, s->profile, -1, s->maskLen, 
+										s->ws, &s->st);
+	else sw_sse2_dword(ref, 0, refLen, s->readLen, s->weight_gapO, s->weight_gapE, s->profile, -1, s->maskLen, s->ws, &s->st);
+	s->st.offset += refLen;
+}
+
+void ssw_stream_result (const s_stream* s, s_align_stream* r) {
+	second_best second = s->st.second;	/* settling a copy leaves the ring as it is for the next chunks */
+	second_flush(&second);
+	r->score1 = s->st.max;
+	r->ref_end1 = s->st.end_ref;
+	r->read_end1 = s->st.end_read;
+	if (s->maskLen >= 15) {
+		r->score2 = second.out.score;
+		r->ref_end2 = second.out.ref;
+	} else {
+		r->score2 = 0;
+		r->ref_end2 = -1;
+	}
+}
+
+void ssw_stream_destroy (s_stream* s) {
+	if (s == 0) return;
+	free(s->profile);
+	workspace_destroy(s->ws);
+	free(s);
+}
+
+int32_t ssw_align_batch (const s_profile* prof, 
+						 const int8_t** refs, 
+						 const int32_t* refLens, 
+						 const int32_t refNum, 
+						 const uint8_t weight_gapO, 
+						 const uint8_t weight_gapE, 
+						 const uint8_t flag,
+						 const uint16_t filters,
+						 const int32_t filterd,
+						 s_align** results) {
+
+	alignment_end* ends;
+	s_workspace* ws;
+	int32_t* idx;
+	int32_t i, num, aligned = 0;
+
+	if (prof->profile_byte == 0 && prof->profile_word == 0) {
+		fprintf(stderr, "Please call the function ssw_init before ssw_align_batch.\n");
+		return 0;
+	}
+	if (refNum <= 0) return 0;
+	ends = (alignment_end*)calloc(refNum, sizeof(alignment_end));
+	idx = (int32_t*)malloc(refNum * sizeof(int32_t));
+	ws = workspace_init();
+
+	// Find the alignment scores and ending positions, 16 targets at a time, then redo the overflowed ones 8 at a time.
+	for (i = 0; i < refNum; ++i) idx[i] = i;
+	num = refNum;
+	if (prof->profile_byte) {
+		sw_sse2_byte_inter(refs, refLens, idx, refNum, prof->read, prof->readLen, prof->mat, prof->n, weight_gapO, weight_gapE, prof->bias, ends);
+		for (i = num = 0; i < refNum; ++i) if (ends[i].score == 255) idx[num ++] = i;
+	}
+	if (num > 0) {
+		sw_sse2_word_inter(refs, refLens, idx, num, prof->read, prof->readLen, prof->mat, prof->n, weight_gapO, weight_gapE, ends);
+	}
+
+	for (i = 0; i < refNum; ++i) {
+		s_align2 a;
+		int8_t ok = 1;
+		if (ends[i].score == 32767 || ! ((flag & 15) == 0 || ((flag & 15) == 2 && ends[i].score < filters))) {
+			/* The target overflowed 16 bits or its beginning position is wanted; align it alone, so that the reverse 
+			   pass and the cigar are found from the same scores as in ssw_align. */
+			ok = align_core(&a, prof, refs[i], refLens[i], weight_gapO, weight_gapE, flag, filters, filterd, 15, 0, 0, ws);
+		} else {
+			a.score1 = ends[i].score;
+			a.ref_begin1 = -1;
+			a.ref_end1 = ends[i].ref;
+			a.read_begin1 = -1;
+			a.read_end1 = ends[i].read;
+			a.cigar = 0;
+			a.cigarLen = 0;
+		}
+		if (ok) {
+			a.score2 = 0;
+			a.ref_end2 = -1;
+			results[i] = align_short(&a);
+			++ aligned;
+		} else results[i] = 0;
+	}
+
+	workspace_destroy(ws);
+	free(idx);
+	free(ends);
+	return aligned;
+}
+
+/* Align up to 16 (word == 0) or 8 (word == 1) reads against ref with the multi-query kernels. */
+static alignment_end* multi_group (int8_t word, 
+								   const int8_t** reads, 
+								   const int32_t* readLens, 
+								   int32_t num, 
+								   const int8_t* ref, 
+								   int32_t refLen, 
+								   const uint8_t weight_gapO, 
+								   const uint8_t weight_gapE, 
+								   const int8_t* mat, 
+								   int32_t n, 
+								   uint8_t bias, 
+								   const int32_t* start, 
+								   const int32_t* terminate, 
+								   int32_t maskLen) {
+	alignment_end* bests;
+	__m128i* vP;
+	int32_t rows = 0, l, seg = word ? 8 : 16;
+	for (l = 0; l < num; ++l) if ((readLens[l] + seg - 1) / seg * seg > rows) rows = (readLens[l] + seg - 1) / seg * seg;
+	if (word == 0) {
+		vP = qP_byte_multi(reads, readLens, num, mat, n, bias, rows);
+		bests = sw_sse2_byte_multi(ref, refLen, readLens, num, rows, weight_gapO, weight_gapE, vP, n, start, terminate, bias, maskLen);
+	} else {
+		vP = qP_word_multi(reads, readLens, num, mat, n, rows);
+		bests = sw_sse2_word_multi(ref, refLen, readLens, num, rows, weight_gapO, weight_gapE, vP, n, start, terminate, maskLen);
+	}
+	free(vP);
+	return bests;
+}
+
+int32_t ssw_align_multi (const int8_t** reads, 
+						 const int32_t* readLens, 
+						 const int32_t readNum, 
+						 const int8_t* mat, 
+						 const int32_t n, 
+						 const int8_t* ref, 
+						 int32_t refLen, 
+						 const uint8_t weight_gapO, 
+						 const uint8_t weight_gapE, 
+						 const uint8_t flag,
+						 const uint16_t filters,
+						 const int32_t filterd,
+						 const int32_t maskLen,
+						 s_align** results) {
+
+	s_align2* r;
+	alignment_end* bests;
+	s_workspace* ws;
+	const int8_t* rp[16];
+	int32_t rl[16], start[16], terminate[16];
+	int8_t* word;	// 0: aligned by the byte kernel; 1: by the word kernel; 2: alone, as in ssw_align2
+	int32_t* idx;
+	int32_t bias = 0, i, k, l, w, num, m, aligned = 0;
+
+	if (readNum <= 0) return 0;
+	if (maskLen < 15) {
+		fprintf(stderr, "When maskLen < 15, the function ssw_align_multi doesn't return 2nd best alignment information.\n");
+	}
+	for (i = 0; i < n*n; i++) if (mat[i] < bias) bias = mat[i];
+	bias = abs(bias);
+	r = (s_align2*)calloc(readNum, sizeof(s_align2));
+	word = (int8_t*)calloc(readNum, sizeof(int8_t));
+	idx = (int32_t*)malloc(readNum * sizeof(int32_t));
+	ws = workspace_init();
+
+	// Find the alignment scores and ending positions, 16 reads at a time, then redo the overflowed ones 8 at a time.
+	for (i = 0; i < readNum; ++i) idx[i] = i;
+	num = readNum;
+	for (w = 0; w < 2; ++w) {
+		int32_t lanes = w ? 8 : 16, overflow = w ? 32767 : 255;
+		for (k = 0; k < num; k += lanes) {
+			m = num - k < lanes ? num - k : lanes;
+			for (l = 0; l < m; ++l) {
+				rp[l] = reads[idx[k + l]];
+				rl[l] = readLens[idx[k + l]];
+			}
+			bests = multi_group(w, rp, rl, m, ref, refLen, weight_gapO, weight_gapE, mat, n, bias, 0, 0, maskLen);
+			for (l = 0; l < m; ++l) {
+				s_align2* a = r + idx[k + l];
+				if (bests[2 * l].score == overflow) {
+					word[idx[k + l]] = w + 1;
+					continue;
+				}
+				a->score1 = bests[2 * l].score;
+				a->ref_end1 = bests[2 * l].ref;
+				a->read_end1 = bests[2 * l].read;
+				a->score2 = maskLen >= 15 ? bests[2 * l + 1].score : 0;
+				a->ref_end2 = maskLen >= 15 ? bests[2 * l + 1].ref : -1;
+				a->ref_begin1 = -1;
+				a->read_begin1 = -1;
+			}
+			free(bests);
+		}
+		for (i = num = 0; i < readNum; ++i) if (word[i] == w + 1) idx[num ++] = i;
+	}
+
+	// The reads that overflow 16 bits are aligned one by one.
+	for (i = 0; i < readNum; ++i) {
+		s_profile* p;
+		if (word[i] != 2) continue;
+		p = ssw_init(reads[i], readLens[i], mat, n, 1);
+		if (! align_core(r + i, p, ref, refLen, weight_gapO, weight_gapE, flag, filters, filterd, maskLen, 0, 0, ws)) word[i] = -1;
+		init_destroy(p);
+	}
+
+	// Find the beginning positions: the reverse pass of all reads in a group runs on the reversed reference up to the 
+	// last of their ending positions, each read starting at its own ending position.
+	for (w = 0; w < 2; ++w) {
+		int32_t lanes = w ? 8 : 16;
+		for (i = num = 0; i < readNum; ++i) {
+			if (word[i] != w || (flag & 15) == 0 || ((flag & 15) == 2 && r[i].score1 < filters)) continue;
+			if (r[i].score1 == 0) {	// as the reverse pass on an empty reference
+				r[i].read_begin1 = 0;
+				continue;
+			}
+			idx[num ++] = i;
+		}
+		for (k = 0; k < num; k += lanes) {
+			int32_t end = 0;
+			int8_t* ref_reverse;
+			m = num - k < lanes ? num - k : lanes;
+			for (l = 0; l < m; ++l) if (r[idx[k + l]].ref_end1 > end) end = r[idx[k + l]].ref_end1;
+			ref_reverse = seq_reverse(ref, end);
+			for (l = 0; l < m; ++l) {
+				s_align2* a = r + idx[k + l];
+				rp[l] = seq_reverse(reads[idx[k + l]], a->read_end1);
+				rl[l] = a->read_end1 + 1;
+				start[l] = end - a->ref_end1;
+				terminate[l] = a->score1;
+			}
+			bests = multi_group(w, rp, rl, m, ref_reverse, end + 1, weight_gapO, weight_gapE, mat, n, bias, start, terminate, 0);
+			for (l = 0; l < m; ++l) {
+				s_align2* a = r + idx[k + l];
+				a->ref_begin1 = end - bests[2 * l].ref;
+				a->read_begin1 = a->read_end1 - bests[2 * l].read;
+				free((int8_t*)rp[l]);
+			}
+			free(bests);
+			free(ref_reverse);
+		}
+	}
+
+	// Generate cigars.
+	for (i = 0; i < readNum; ++i) {
+		s_align2* a = r + i;
+		if (word[i] < 0) {
+			results[i] = 0;
+			continue;
+		}
+		if (word[i] != 2 && a->read_begin1 >= 0 && want_cigar(a, flag, filters, filterd)) {
+			if (! align_cigar(a, ref, reads[i], weight_gapO, weight_gapE, mat, n, ws)) {
+				results[i] = 0;
+				continue;
+			}
+		}
+		results[i] = align_short(a);
+		++ aligned;
+	}
+
+	workspace_destroy(ws);
+	free(idx);
+	free(word);
+	free(r);
+	return aligned;
+}
+
+/* Layout of the files written by ssw_index_write, in the byte order of the machine that wrote them:
+	header	index_header
+	contigs	n index_contig, at header.contigs
+	names	the n names, NUL terminated, at header.names
+	seq	the n encoded contigs, each at a 64-byte boundary, from header.seq which is at a page boundary */
+#define INDEX_MAGIC "SSWIDX01"
+#define INDEX_ORDER 0x01020304
+#define INDEX_PAGE 4096
+
+typedef struct {
+	char magic[8];
+	uint32_t order;	// INDEX_ORDER, to detect a file written with the other byte order
+	int32_t n;
+	uint64_t size, contigs, names, seq;
+	int8_t table[128];
+	char letter[128];
+} index_header;
+
+typedef struct {
+	uint64_t seq;	// offset in the file
+	int32_t len;
+	int32_t name;	// offset in the names
+} index_contig;
+
+static int32_t pad (FILE* f, uint64_t* pos, uint64_t align) {
+	static const char zero[INDEX_PAGE] = {0};
+	uint64_t l = (align - *pos % align) % align;
+	*pos += l;
+	return fwrite(zero, 1, l, f) == l ? 0 : -1;
+}
+
+int32_t ssw_index_write (const char* path, 
+						 const int32_t n, 
+						 const char* const* name, 
+						 const int8_t* const* seq, 
+						 const int32_t* len, 
+						 const int8_t* table, 
+						 const char* letter) {
+	index_header h;
+	index_contig c;
+	uint64_t pos, names_len = 0;
+	int32_t i, e = 0;
+	FILE* f;
+
+	memset(&h, 0, sizeof(index_header));
+	memcpy(h.magic, INDEX_MAGIC, 8);
+	h.order = INDEX_ORDER;
+	h.n = n;
+	memcpy(h.table, table, 128);
+	memcpy(h.letter, letter, 128);
+	h.contigs = sizeof(index_header);
+	h.names = h.contigs + (uint64_t)n * sizeof(index_contig);
+	for (i = 0; i < n; ++i) names_len += strlen(name[i]) + 1;
+	h.seq = (h.names + names_len + INDEX_PAGE - 1) / INDEX_PAGE * INDEX_PAGE;
+	for (pos = h.seq, i = 0; i < n; ++i) pos = (pos + len[i] + 63) / 64 * 64;
+	h.size = pos;
+
+	if ((f = fopen(path, "wb")) == 0) return -1;
+	e |= fwrite(&h, sizeof(index_header), 1, f) != 1;
+	for (pos = h.seq, names_len = 0, i = 0; i < n; ++i) {
+		c.seq = pos;
+		c.len = len[i];
+		c.name = names_len;
+		e |= fwrite(&c, sizeof(index_contig), 1, f) != 1;
+		pos = (pos + len[i] + 63) / 64 * 64;
+		names_len += strlen(name[i]) + 1;
+	}
+	for (i = 0; i < n; ++i) e |= fwrite(name[i], 1, strlen(name[i]) + 1, f) != strlen(name[i]) + 1;
+	pos = h.names + names_len;
+	e |= pad(f, &pos, INDEX_PAGE);
+	for (i = 0; i < n; ++i) {
+		e |= fwrite(seq[i], 1, len[i], f) != (size_t)len[i];
+		pos += len[i];
+		e |= pad(f, &pos, 64);
+	}
+	e |= fclose(f) != 0;
+	return e ? -1 : 0;
+}
+
+#ifdef SSW_INDEX
+s_index* ssw_index_open (const char* path) {
+	s_index* idx;
+	const index_header* h;
+	const index_contig* c;
+	const char* map;
+	struct stat st;
+	int32_t* len;
+	int32_t i, fd = open(path, O_RDONLY);
+
+	if (fd < 0) return 0;
+	if (fstat(fd, &st) != 0 || (uint64_t)st.st_size < sizeof(index_header)) {
+		close(fd);
+		return 0;
+	}
+	map = (const char*)mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);	// the mapping stays valid
+	if (map == MAP_FAILED) return 0;
+	h = (const index_header*)map;
+	c = (const index_contig*)(map + sizeof(index_header));
+	if (memcmp(h->magic, INDEX_MAGIC, 8) || h->order != INDEX_ORDER || h->size != (uint64_t)st.st_size || h->n < 0 
+		|| h->contigs != sizeof(index_header) || h->names != h->contigs + (uint64_t)h->n * sizeof(index_contig) 
+		|| h->seq < h->names || h->seq > h->size) {
+		munmap((void*)map, st.st_size);
+		return 0;
+	}
+
+	idx = (s_index*)calloc(1, sizeof(s_index));
+	idx->n = h->n;
+	idx->name = (const char**)malloc(h->n * sizeof(char*));
+	idx->seq = (const int8_t**)malloc(h->n * sizeof(int8_t*));
+	idx->len = len = (int32_t*)malloc(h->n * sizeof(int32_t));
+	idx->table = h->table;
+	idx->letter = h->letter;
+	idx->map = (void*)map;
+	idx->size = st.st_size;
+	for (i = 0; i < h->n; ++i) {
+		uint64_t name = h->names + (uint64_t)c[i].name;
+		if (c[i].len < 0 || c[i].seq < h->seq || c[i].seq + c[i].len > h->size || c[i].name < 0 || name >= h->seq 
+			|| memchr(map + name, 0, h->seq - name) == 0) {
+			ssw_index_close(idx);
+			return 0;
+		}
+		idx->name[i] = map + name;
+		idx->seq[i] = (const int8_t*)(map + c[i].seq);
+		len[i] = c[i].len;
+	}
+	return idx;
+}
+
+void ssw_index_close (s_index* idx) {
+	if (idx == 0) return;
+	munmap(idx->map, idx->size);
+	free(idx->name);
+	free(idx->seq);
+	free((int32_t*)idx->len);
+	free(idx);
+}
+#endif	// SSW_INDEX
+
+s_workspace* workspace_init (void) {
+	return (s_workspace*)calloc(1, sizeof(s_workspace));
+}
+
+void workspace_destroy (s_workspace* ws) {
+	int32_t i;
+	if (ws == 0) return;
+	for (i = 0; i < WS_NUM; ++i) _mm_free(ws->buf[i]);
+	free(ws);
+}
+
 void align_destroy (s_align* a) {
 	free(a->cigar);
 	free(a);
 }
+
+void align2_destroy (s_align2* a) {
+	free(a->cigar);
+	free(a);
+}
@@ -16,10 +16,24 @@
 #include <string.h>
 #include <emmintrin.h>
 
+/* ssw_index_open and ssw_index_close map the file with POSIX calls, so they are only built where these exist. Define 
+   SSW_NO_INDEX to leave them out. */
+#if (defined(__unix__) || defined(__APPLE__)) && !defined(SSW_NO_INDEX)
+#define SSW_INDEX
+#endif
+
 /*!	@typedef	structure of the query profile	*/
 struct _profile;
 typedef struct _profile s_profile;
 
+/*!	@typedef	structure of the buffers reused by the alignments of one thread, see workspace_init	*/
+struct _workspace;
+typedef struct _workspace s_workspace;
+
+/*!	@typedef	structure of the state of an alignment against a reference given in chunks, see ssw_stream_init	*/
+struct _stream;
+typedef struct _stream s_stream;
+
 /*!	@typedef	structure of the alignment result
 	@field	score1	the best alignment score
 	@field	score2	sub-optimal alignment score
@@ -46,6 +60,53 @@ typedef struct {
 	int32_t cigarLen;	
 } s_align;
 
+/*!	@typedef	structure of the alignment result, version 2
+	@discussion	The fields are the same as in s_align, but score1 and score2 are 32-bit. s_align can only hold scores up to 
+				65535; alignments that score higher (e.g. contig against contig) need ssw_align2, which returns this structure.
+*/
+typedef struct {
+	int32_t score1;	
+	int32_t score2;	
+	int32_t ref_begin1;	
+	int32_t ref_end1;	
+	int32_t	read_begin1;	
+	int32_t read_end1;	
+	int32_t ref_end2;
+	uint32_t* cigar;	
+	int32_t cigarLen;	
+} s_align2;
+
+/*!	@typedef	structure of the result of an alignment against a reference given in chunks
+	@discussion	The fields are the same as in s_align2, but the positions on the reference are 64-bit. The beginning 
+				positions and the cigar are not available.
+*/
+typedef struct {
+	int32_t score1;
+	int32_t score2;
+	int64_t ref_end1;
+	int32_t read_end1;
+	int64_t ref_end2;
+} s_align_stream;
+
+/*!	@typedef	structure of an encoded reference mapped from a file, see ssw_index_open
+	@field	n	number of contigs
+	@field	name	array of the n contig names
+	@field	seq	array of the n contigs, encoded as the target sequence of ssw_align
+	@field	len	array of the lengths of the n contigs
+	@field	table	the 128 numbers that the letters were encoded with (letter -> number)
+	@field	letter	the letter written for each number (128 entries, number -> letter)
+*/
+typedef struct _index {
+	int32_t n;
+	const char** name;
+	const int8_t** seq;
+	const int32_t* len;
+	const int8_t* table;
+	const char* letter;
+	void* map;	// the mapping of the file
+	size_t size;
+} s_index;
+
 #ifdef __cplusplus
 extern "C" {
 #endif	// __cplusplus
@@ -57,6 +118,8 @@ extern "C" {
 	@param	n	the square root of the number of elements in mat (mat has n*n elements)
 	@param	score_size	estimated Smith-Waterman score; if your estimated best alignment score is surely < 255 please set 0; if 
 						your estimated best alignment score >= 255, please set 1; if you don't know, please set 2 
+						(with GCC or Clang, the 16-bit profile is then built at the first alignment that 
+						overflows 8 bits; the profile can be used by several threads at a time in any case)
 	@return	pointer to the query profile structure
 	@note	example for parameter read and mat:
 			If the query sequence is: ACGTATC, the sequence that read points to can be: 1234142
@@ -89,11 +152,25 @@ void init_destroy (s_profile* p);
 					cigar; bit 7: when setted as 1, if the best alignment score >= filters, (whatever bit 5 is setted) the function
   					will return the best alignment beginning position and cigar; bit 8: when setted as 1, (whatever bit 5, 6 or 7 is
  					setted) the function will always return the best alignment beginning position and cigar. When flag == 0, only 
-					the optimal and sub-optimal scores and the optimal alignment ending position will be returned.
-	@param	filters	score filter: when bit 7 of flag is setted as 1 and bit 8 is setted as 0, filters will be used (Please check the
+					the optimal and sub-optimal scores and the optimal alignment ending position will be returned. bit 4: when 
+					setted as 1, the beginning position and cigar asked for by bits 5-8 are traced back from direction bits 
+					recorded during the forward pass, instead of being found by a reverse pass and a banded alignment; this needs 
+					about readLen * refLen / 2 bytes, so it is meant for short reads against short targets or windows. Larger 
+					matrices and scores that overflow 16 bits are aligned the usual way. bit 3: when setted as 1, the 
+					alignment is abandoned as soon as its score cannot reach filters (whatever bit 7 is setted); the score and 
+					positions returned are then those of the part aligned, below filters, and neither beginning position nor 
+					cigar is returned. The alignments that reach filters are returned as without this bit. An alignment can 
+					still start at any later column, so the scan only stops in the last filters / (largest score of mat) 
+					columns of the target: this is for short targets, as in a database search. With bit 4, it only applies to the 
+					matrices aligned the usual way. bit 2: when setted as 1, the scan of the target stops at the first column 
+					whose scores are all more than filterd below the best score so far (X-drop, with X = filterd > 0), as when 
+					extending a seed at the start of the target; filterd is then not a distance filter, so bit 6 should not be 
+					setted. The best alignment found before that column is returned, and the sub-optimal one is only looked 
+					for in the columns scanned. With bit 4, it only applies to the matrices aligned the usual way.
+	@param	filters	score filter: when bit 7 of flag is setted as 1 and bit 8 is setted as 0, or bit 3, filters will be used (Please check the
  					decription of the flag parameter for detailed usage.)
-	@param	filterd	distance filter: when bit 6 of flag is setted as 1 and bit 8 is setted as 0, filterd will be used (Please check 
-					the decription of the flag parameter for detailed usage.)
+	@param	filterd	distance filter: when bit 6 of flag is setted as 1 and bit 8 is setted as 0, filterd will be used; X of the 
+					X-drop when bit 2 is setted (Please check the decription of the flag parameter for detailed usage.)
 	@param	maskLen	The distance between the optimal and suboptimal alignment ending position >= maskLen. We suggest to use 
 					readLen/2, if you don't have special concerns. Note: maskLen has to be >= 15, otherwise this function will NOT 
 					return the suboptimal alignment information. Detailed description of maskLen: After locating the optimal
@@ -106,7 +183,10 @@ void init_destroy (s_profile* p);
 	@note	Whatever the parameter flag is setted, this function will at least return the optimal and sub-optimal alignment score,
 			and the optimal alignment ending positions on target and query sequences. If both bit 6 and 7 of the flag are setted
 			while bit 8 is not, the function will return cigar only when both criteria are fulfilled. All returned positions are 
-			0-based coordinate.  	
+			0-based coordinate. When the 16-bit kernel saturates, the alignment is redone with 32-bit scores, so the positions 
+			are still right; the scores are capped at 65535 in s_align, use ssw_align2 to get them in full. With bit 4 of the 
+			flag, the forward pass has no lazy-F approximation, so a score can be slightly higher than without it when an 
+			insertion is next to a deletion.
 */
 s_align* ssw_align (const s_profile* prof, 
 					const int8_t* ref, 
@@ -118,11 +198,243 @@ s_align* ssw_align (const s_profile* prof,
 					const int32_t filterd,
 					const int32_t maskLen);
 
+/*!	@function	Do Striped Smith-Waterman alignment and return the result with 32-bit scores.
+	@discussion	The parameters are the same as those of ssw_align, except that filters is 32-bit.
+	@return	pointer to the alignment result structure; release it with align2_destroy
+*/
+s_align2* ssw_align2 (const s_profile* prof, 
+					  const int8_t* ref, 
+					  int32_t refLen, 
+					  const uint8_t weight_gapO, 
+					  const uint8_t weight_gapE, 
+					  const uint8_t flag,	
+					  const int32_t filters,
+					  const int32_t filterd,
+					  const int32_t maskLen);
+
+/*!	@function	Create a workspace for ssw_align_ws and ssw_align2_ws.
+	@return	pointer to the workspace structure
+	@discussion	ssw_align allocates and frees its working buffers (score columns, reverse profile, band, cigar) at each call. 
+				A workspace keeps them between calls instead, growing them to the largest alignment seen, which saves 
+				most of the allocator traffic when many short reads are aligned. A workspace holds no result and can be 
+				used with any query profile, but only by one alignment at a time: use one workspace per thread.
+*/
+s_workspace* workspace_init (void);
+
+/*!	@function	Release the memory allocated by function workspace_init and the buffers it holds.
+	@param	ws	pointer to the workspace structure
+*/
+void workspace_destroy (s_workspace* ws);
+
+/*!	@function	Do Striped Smith-Waterman alignment with the buffers of a workspace.
+	@param	ws	pointer to the workspace structure, created by workspace_init
+	@discussion	The other parameters and the result are the same as those of ssw_align.
+*/
+s_align* ssw_align_ws (s_workspace* ws, 
+					   const s_profile* prof, 
+					   const int8_t* ref, 
+					   int32_t refLen, 
+					   const uint8_t weight_gapO, 
+					   const uint8_t weight_gapE, 
+					   const uint8_t flag,	
+					   const uint16_t filters,
+					   const int32_t filterd,
+					   const int32_t maskLen);
+
+/*!	@function	Do Striped Smith-Waterman alignment with the buffers of a workspace and return the result with 32-bit scores.
+	@param	ws	pointer to the workspace structure, created by workspace_init
+	@discussion	The other parameters and the result are the same as those of ssw_align2.
+*/
+s_align2* ssw_align2_ws (s_workspace* ws, 
+						 const s_profile* prof, 
+						 const int8_t* ref, 
+						 int32_t refLen, 
+						 const uint8_t weight_gapO, 
+						 const uint8_t weight_gapE, 
+						 const uint8_t flag,	
+						 const int32_t filters,
+						 const int32_t filterd,
+						 const int32_t maskLen);
+
+/*!	@function	Align a read and its reverse complement against the same reference in one scan and return the better one.
+	@param	ws	pointer to the workspace structure, created by workspace_init
+	@param	prof	pointer to the query profile structure of the read
+	@param	prof_rc	pointer to the query profile structure of the reverse complement of the read, made by ssw_init with the 
+					same mat, n and score_size; 0: the read only, as ssw_align2_ws
+	@param	strand	set to 0 if the alignment returned is that of prof, 1 if it is that of prof_rc
+	@param	scores	array of 2, set to the optimal alignment scores of prof and prof_rc (0 without prof_rc)
+	@return	pointer to the alignment result structure of the strand with the higher score (prof on a tie); release it with 
+			align2_destroy. 0 on error.
+	@discussion	The other parameters are the same as those of ssw_align2. Both profiles are stepped through each column of 
+				ref together, so the reference is read once for both strands. The beginning position and cigar are 
+				then only looked for on the better strand: the result is the one ssw_align2_ws returns for that strand.
+*/
+s_align2* ssw_align2_dual (s_workspace* ws, 
+						   const s_profile* prof, 
+						   const s_profile* prof_rc, 
+						   const int8_t* ref, 
+						   int32_t refLen, 
+						   const uint8_t weight_gapO, 
+						   const uint8_t weight_gapE, 
+						   const uint8_t flag,
+						   const int32_t filters,
+						   const int32_t filterd,
+						   const int32_t maskLen,
+						   int8_t* strand,
+						   int32_t* scores);
+
+/*!	@function	Start to align the query against a reference that is given in chunks.
+	@param	prof	pointer to the query profile structure
+	@param	weight_gapO	the absolute value of gap open penalty  
+	@param	weight_gapE	the absolute value of gap extension penalty
+	@param	maskLen	the same as that of ssw_align
+	@return	pointer to the stream structure
+	@discussion	Feed the reference with ssw_stream_feed, in chunks of any size, and get the result with ssw_stream_result. 
+				The score columns and the best and sub-optimal alignments are carried from one chunk to the next, so the 
+				memory does not depend on the reference length, which is only limited by the 64-bit positions: a 
+				chromosome or a whole genome can be aligned from a file or a pipe. The result does not depend on how the 
+				reference is cut into chunks.
+	@note	The 8-, 16- or 32-bit scores are chosen from the largest score that the query can reach, since the reference 
+			cannot be aligned again when they overflow; they can differ from the ones ssw_align2 would use, in either 
+			direction: wider for a long query, narrower for a profile of score_size 1, which ssw_align2 always aligns 
+			with 16 bits. The kernels of each width approximate the lazy-F loop a little differently, so score1 can then 
+			differ slightly from that of ssw_align2 when an insertion is next to a deletion; score2 and ref_end2 then 
+			follow the edge that the kernels of the stream's width give the mask around the best alignment, so they can 
+			differ by more, and ref_end2 by a position.
+*/
+s_stream* ssw_stream_init (const s_profile* prof, 
+						   const uint8_t weight_gapO, 
+						   const uint8_t weight_gapE, 
+						   const int32_t maskLen);
+
+/*!	@function	Align the query against the next chunk of the reference.
+	@param	s	pointer to the stream structure
+	@param	ref	pointer to the chunk, encoded as the target sequence of ssw_align
+	@param	refLen	length of the chunk
+*/
+void ssw_stream_feed (s_stream* s, const int8_t* ref, int32_t refLen);
+
+/*!	@function	Get the alignment of the query against the reference fed so far.
+	@param	s	pointer to the stream structure
+	@param	r	pointer to the result structure to fill; ref_end1 = -1 when nothing is aligned
+	@discussion	The stream can still be fed after this.
+*/
+void ssw_stream_result (const s_stream* s, s_align_stream* r);
+
+/*!	@function	Release the memory allocated by function ssw_stream_init.
+	@param	s	pointer to the stream structure
+*/
+void ssw_stream_destroy (s_stream* s);
+
+/*!	@function	Align the query against many target sequences, several targets at a time.
+	@param	prof	pointer to the query profile structure
+	@param	refs	array of refNum pointers to the target sequences, encoded as for ssw_align
+	@param	refLens	array of the lengths of the target sequences
+	@param	refNum	number of target sequences
+	@param	results	array of refNum pointers, filled with the alignment result of each target; results[i] = 0 if target i 
+					could not be aligned. Release each result with align_destroy.
+	@return	number of targets aligned
+	@discussion	weight_gapO, weight_gapE, flag, filters and filterd are the same as those of ssw_align. Each SIMD lane holds a 
+				different target (16 with 8-bit scores, 8 with 16-bit scores), which is much faster than calling ssw_align 
+				in a loop when the targets are short, e.g. a protein or amplicon database. Targets that overflow the 8-bit 
+				scores are redone with 16-bit scores. The sub-optimal alignment is not searched: score2 is 0 and ref_end2 is -1.
+	@note	The batch kernels have no lazy-F approximation, so a score can be slightly higher than the one from ssw_align 
+			when an insertion is next to a deletion. The targets whose beginning position or cigar is wanted (see flag), 
+			as well as those that overflow 16 bits, are aligned one by one as in ssw_align and get its result.
+*/
+int32_t ssw_align_batch (const s_profile* prof, 
+						 const int8_t** refs, 
+						 const int32_t* refLens, 
+						 const int32_t refNum, 
+						 const uint8_t weight_gapO, 
+						 const uint8_t weight_gapE, 
+						 const uint8_t flag,	
+						 const uint16_t filters,
+						 const int32_t filterd,
+						 s_align** results);
+
+/*!	@function	Align many reads against one target sequence, several reads at a time.
+	@param	reads	array of readNum pointers to the query sequences, encoded as for ssw_init
+	@param	readLens	array of the lengths of the query sequences
+	@param	readNum	number of query sequences
+	@param	mat	pointer to the substitution matrix, as for ssw_init
+	@param	n	the square root of the number of elements in mat
+	@param	ref	pointer to the target sequence, as for ssw_align
+	@param	refLen	length of the target sequence
+	@param	results	array of readNum pointers, filled with the alignment result of each read; results[i] = 0 if read i 
+					could not be aligned. Release each result with align_destroy.
+	@return	number of reads aligned
+	@discussion	weight_gapO, weight_gapE, flag, filters, filterd and maskLen are the same as those of ssw_align. Each SIMD 
+				lane holds a different read (16 with 8-bit scores, 8 with 16-bit scores) and one pass over the target 
+				aligns them all, so no query profile is built per read with ssw_init. This is meant for many short reads 
+				against a short target, e.g. amplicon reads against their amplicon. Reads that overflow the 8-bit scores 
+				are redone with 16-bit scores, and the ones that overflow 16 bits are aligned one by one as in ssw_align.
+	@note	The multi-query kernels have no lazy-F approximation, so a score can be slightly higher than the one from 
+			ssw_align when an insertion is next to a deletion.
+*/
+int32_t ssw_align_multi (const int8_t** reads, 
+						 const int32_t* readLens, 
+						 const int32_t readNum, 
+						 const int8_t* mat, 
+						 const int32_t n, 
+						 const int8_t* ref, 
+						 int32_t refLen, 
+						 const uint8_t weight_gapO, 
+						 const uint8_t weight_gapE, 
+						 const uint8_t flag,	
+						 const uint16_t filters,
+						 const int32_t filterd,
+						 const int32_t maskLen,
+						 s_align** results);
+
+/*!	@function	Write an encoded reference to a file that ssw_index_open can map.
+	@param	path	name of the file to write
+	@param	n	number of contigs
+	@param	name	array of the n contig names
+	@param	seq	array of the n contigs, encoded as the target sequence of ssw_align
+	@param	len	array of the lengths of the n contigs
+	@param	table	the 128 numbers that the letters were encoded with, stored to check the index against the queries
+	@param	letter	the letter to write for each of the 128 numbers, stored for the output
+	@return	0 on success, -1 if the file could not be written
+	@discussion	The contigs are stored as they are given, one byte per residue, from a page boundary and each at a 64-byte 
+				boundary, so that they can be aligned in place from the mapping. The file is in the byte order of the 
+				machine that writes it.
+*/
+int32_t ssw_index_write (const char* path, 
+						 const int32_t n, 
+						 const char* const* name, 
+						 const int8_t* const* seq, 
+						 const int32_t* len, 
+						 const int8_t* table, 
+						 const char* letter);
+
+#ifdef SSW_INDEX
+/*!	@function	Map an encoded reference written by ssw_index_write.
+	@param	path	name of the file
+	@return	pointer to the index structure; 0 if the file cannot be opened or is not an index written on a machine with the 
+			same byte order
+	@discussion	The file is mapped read only and nothing is decoded, so opening does not depend on the reference length, 
+				and the processes that map the same file share its pages in the page cache. The contigs can be given to 
+				ssw_align and the other functions directly. An index can be used by several threads at a time.
+*/
+s_index* ssw_index_open (const char* path);
+
+/*!	@function	Unmap an encoded reference and release the memory allocated by function ssw_index_open.
+	@param	idx	pointer to the index structure
+*/
+void ssw_index_close (s_index* idx);
+#endif	// SSW_INDEX
+
 /*!	@function	Release the memory allocated by function ssw_align.
 	@param	a	pointer to the alignment result structure
 */
 void align_destroy (s_align* a);
 
+/*!	@function	Release the memory allocated by function ssw_align2.
+	@param	a	pointer to the alignment result structure
+*/
+void align2_destroy (s_align2* a);
+
 #ifdef __cplusplus
 }
 #endif	// __cplusplus
@@ -211,6 +211,7 @@ int CalculateNumberMismatch(
 void SetFlag(const StripedSmithWaterman::Filter& filter, uint8_t* flag) {
   if (filter.report_begin_position) *flag |= 0x08;
   if (filter.report_cigar) *flag |= 0x0f;
+  if (filter.abandon_below_score_filter) *flag |= 0x20;
 }
 
 } // namespace
@@ -407,6 +408,40 @@ bool Aligner::Align(const char* query, const char* ref, const int& ref_len,
   return true;
 }
 
+bool Aligner::Align(const char* query, const Reference& ref, const int& contig, 
+                    const Filter& filter, Alignment* alignment) const
+{
+  if (!matrix_built_) return false;
+  if (contig < 0 || contig >= ref.Size()) return false;
+
+  int query_len = strlen(query);
+  if (query_len == 0) return false;
+  int8_t* translated_query = new int8_t[query_len];
+  TranslateBase(query, query_len, translated_query);
+
+  const int8_t score_size = 2;
+  s_profile* profile = ssw_init(translated_query, query_len, score_matrix_, 
+                                score_matrix_size_, score_size);
+
+  uint8_t flag = 0;
+  SetFlag(filter, &flag);
+  s_align* s_al = ssw_align(profile, ref.Sequence(contig), ref.Length(contig),
+                                 static_cast<int>(gap_opening_penalty_), 
+				 static_cast<int>(gap_extending_penalty_),
+				 flag, filter.score_filter, filter.distance_filter, query_len);
+  
+  alignment->Clear();
+  ConvertAlignment(*s_al, query_len, alignment);
+  alignment->mismatches = CalculateNumberMismatch(&*alignment, ref.Sequence(contig), translated_query);
+
+  // Free memory
+  delete [] translated_query;
+  align_destroy(s_al);
+  init_destroy(profile);
+
+  return true;
+}
+
 void Aligner::Clear(void) {
   if (score_matrix_) delete [] score_matrix_;
   score_matrix_ = NULL;
@@ -482,4 +517,42 @@ void Aligner::BuildDefaultMatrix(void) {
   matrix_built_   = true;
   default_matrix_ = true;
 }
+Reference::Reference(void)
+    : index_(NULL)
+{}
+
+Reference::~Reference(void) {
+  Close();
+}
+
+bool Reference::Open(const char* filename) {
+  Close();
+#ifdef SSW_INDEX
+  index_ = ssw_index_open(filename);
+#endif
+  return index_ != NULL;
+}
+
+void Reference::Close(void) {
+#ifdef SSW_INDEX
+  ssw_index_close(index_);
+#endif
+  index_ = NULL;
+}
+
+int Reference::Size(void) const {
+  return index_ ? index_->n : 0;
+}
+
+const char* Reference::Name(const int& i) const {
+  return index_->name[i];
+}
+
+const int8_t* Reference::Sequence(const int& i) const {
+  return index_->seq[i];
+}
+
+int Reference::Length(const int& i) const {
+  return index_->len[i];
+}
 } // namespace StripedSmithWaterman
@@ -5,6 +5,8 @@
 #include <string>
 #include <vector>
 
+struct _index;
+
 namespace StripedSmithWaterman {
 
 struct Alignment {
@@ -50,15 +52,55 @@ struct Filter {
   uint16_t score_filter;         // score >= score_filter
   uint16_t distance_filter;      // ((ref_end - ref_begin) < distance_filter) &&
                                  // ((query_end - read_begin) < distance_filter)
+  bool abandon_below_score_filter; // Stop aligning as soon as score_filter cannot be reached.
+                                   //   sw_score is then below score_filter, but not the full score.
 
   Filter()
     : report_begin_position(true)
     , report_cigar(true)
     , score_filter(0)
     , distance_filter(32767)
+    , abandon_below_score_filter(false)
   {};
 };
 
+class Reference {
+ public:
+  Reference(void);
+  ~Reference(void);
+
+  // =========
+  // @function Map a reference index written by "ssw_test index".
+  //           The contigs are already translated and are aligned in place
+  //             from the mapping, which is shared by all processes that
+  //             map the same file.
+  //           [NOTICE] The index must be written with the translation
+  //                    matrix of the Aligner that aligns against it.
+  //           [NOTICE] If an index is opened, it is closed first.
+  //           [NOTICE] Without SSW_INDEX (see ssw.h), no index can be
+  //                    mapped and Open always fails.
+  // @param    filename The index file.
+  // @return   True: succeed; false: fail.
+  // =========
+  bool Open(const char* filename);
+
+  void Close(void);
+
+  // @function The number of contigs; 0 if no index is opened.
+  int Size(void) const;
+
+  // @function The name, the translated bases and the length of contig i.
+  const char*   Name(const int& i) const;
+  const int8_t* Sequence(const int& i) const;
+  int           Length(const int& i) const;
+
+ private:
+  _index* index_;
+
+  Reference& operator= (const Reference&);
+  Reference (const Reference&);
+}; // class Reference
+
 class Aligner {
  public:
   // =========
@@ -139,6 +181,18 @@ class Aligner {
   bool Align(const char* query, const char* ref, const int& ref_len, 
              const Filter& filter, Alignment* alignment) const;
 
+  // =========
+  // @function Align the query againt a contig of a mapped reference index.
+  // @param    query     The query sequence.
+  // @param    ref       The reference index.
+  // @param    contig    The contig of the index, from 0 to ref.Size() - 1.
+  // @param    filter    The filter for the alignment.
+  // @param    alignment The container contains the result.
+  // @return   True: succeed; false: fail.
+  // =========
+  bool Align(const char* query, const Reference& ref, const int& contig, 
+             const Filter& filter, Alignment* alignment) const;
+
   // @function Clear up all containers and thus the aligner is disabled.
   //             To rebuild the aligner please use Build functions.
   void Clear(void);